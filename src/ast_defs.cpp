@@ -1,7 +1,11 @@
 #include "ast_defs.hpp"
+#include "options.hpp"
 #include <cassert>
+#include <cstdint>
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace Ast_Base {
 
@@ -13,6 +17,74 @@ int loop_cnt = 0;
 
 constexpr const char* SHORT_TMP_VAR_NAME = "@_tmp_short";
 
+std::unordered_set<std::string> readonly_globals;
+
+Arena ast_arena;
+
+void* Arena::allocate(size_t size, size_t align) {
+	size_t pad = -(uintptr_t)cur & (align - 1);
+	if(pad + size > left) {
+		// big requests get a block of their own so the current one keeps its room
+		if(size > BLOCK_SIZE / 4) {
+			blocks.push_back(new char[size]);
+			return blocks.back();
+		}
+		blocks.push_back(new char[BLOCK_SIZE]);
+		cur = blocks.back();
+		left = BLOCK_SIZE;
+		pad = 0;
+	}
+	void* ret = cur + pad;
+	cur += pad + size;
+	left -= pad + size;
+	return ret;
+}
+
+void Arena::rewind(Mark const& to) {
+	while(blocks.size() > to.blocks) {
+		delete[] blocks.back();
+		blocks.pop_back();
+	}
+	cur = to.cur;
+	left = to.left;
+}
+
+void Arena::release() {
+	for(auto i : blocks) {
+		delete[] i;
+	}
+	blocks.clear();
+	cur = nullptr;
+	left = 0;
+}
+
+// deque keeps the names in place for the views in ident_ids
+std::deque<std::string> ident_names;
+std::unordered_map<std::string_view, int> ident_ids;
+
+Ident intern(std::string_view name) {
+	auto it = ident_ids.find(name);
+	if(it != ident_ids.end()) {
+		return {it->second};
+	}
+	int id = ident_names.size();
+	ident_ids.emplace(ident_names.emplace_back(name), id);
+	return {id};
+}
+
+const std::string& Ident::str() const {
+	return ident_names[id];
+}
+
+std::ostream& operator<<(std::ostream& out, Ident ident) {
+	return out << ident.str();
+}
+
+// Globals created while a function is being emitted (e.g. local const arrays),
+// flushed in front of that function.
+std::ostringstream hoisted_globals_buf;
+Ost hoisted_globals(hoisted_globals_buf);
+
 
 namespace Koopa_Val_Def {
 
@@ -25,144 +97,189 @@ enum Koopa_value_type {
 	// KOOPA_VALUE_TYPE_PTR,
 };
 
-class Koopa_val_base {
+// Element values of a const array, row-major.
+class Const_array {
 public:
-	virtual std::string get_str() const = 0;
-	virtual void prepare(Ost& outstr, std::string prefix) { return; }
-	virtual Koopa_value_type val_type() const = 0;
-	virtual ~Koopa_val_base() { return; }
+	std::vector<int> dims;
+	std::vector<int> data;
+	bool contains(std::vector<int> const & index) const {
+		if(index.size() != dims.size()) {
+			return false;
+		}
+		for(size_t i = 0; i < index.size(); i++) {
+			if(index[i] < 0 || index[i] >= dims[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+	int get(std::vector<int> const & index) const {
+		size_t pos = 0;
+		for(size_t i = 0; i < index.size(); i++) {
+			pos = pos * dims[i] + index[i];
+		}
+		return data[pos];
+	}
 };
 
-class Koopa_val_im : public Koopa_val_base {
-private:
-	int val;
-
+// What every use of a name shares, set once where it is defined.
+class Symbol_info {
 public:
-	Koopa_val_im(int x) { val = x; }
-	int get_im_val() const { return val; }
-	std::string get_str() const override {
-		return std::to_string(val);
+	std::string id;   // without '@'
+	int max_dep = 0;   // max size of dimension
+	bool is_ptr = false;
+	bool is_func_void = false;
+	std::shared_ptr<const Const_array> const_array;
+	void set_id(std::string const & str) {
+		id = str + "_" + std::to_string(named_var_cnt);
+		named_var_cnt++;
 	}
-	Koopa_value_type val_type() const override { return KOOPA_VALUE_TYPE_IMMEDIATE; }
 };
 
-class Koopa_val_temp_symbol : public Koopa_val_base {
+// Kept for the whole compilation, values only point into it.
+std::deque<Symbol_info> symbol_infos;
+
+Symbol_info* new_symbol_info() {
+	return &symbol_infos.emplace_back();
+}
+
+// Holds up to N elements in place and only goes to the heap beyond that.
+template<typename T, size_t N>
+class Small_vector {
 private:
-	int id;
+	T local[N];
+	std::vector<T> spilled;   // all of them while there are more than N
+	size_t len = 0;
 
 public:
-	Koopa_val_temp_symbol(int x) {
-		id = x;
-	}
-	std::string get_str() const override {
-		return std::string("%") + std::to_string(id);
+	T* begin() { return len > N ? spilled.data() : local; }
+	T* end() { return begin() + len; }
+	const T* begin() const { return len > N ? spilled.data() : local; }
+	const T* end() const { return begin() + len; }
+	auto rbegin() { return std::reverse_iterator(end()); }
+	auto rend() { return std::reverse_iterator(begin()); }
+	size_t size() const { return len; }
+	bool empty() const { return len == 0; }
+	T& back() { return begin()[len - 1]; }
+	void push_back(T const & x) {
+		if(len < N) {
+			local[len++] = x;
+			return;
+		}
+		if(len == N) {
+			spilled.assign(local, local + N);
+		}
+		spilled.push_back(x);
+		len++;
+	}
+	void pop_back() {
+		len--;
+		if(len == N) {
+			std::copy(spilled.begin(), spilled.begin() + N, local);
+			spilled.clear();
+		} else if(len > N) {
+			spilled.pop_back();
+		}
 	}
-	Koopa_value_type val_type() const override { return KOOPA_VALUE_TYPE_TEMP; }
 };
 
-class Koopa_val_named_symbol : public Koopa_val_base {
+// An operand: an immediate, a temporary, or a name with the indices it is
+// used with. A plain value, copied around without allocating.
+class Koopa_val {
 private:
-	std::string id;
-	int cache_id;
-	int max_dep;   // max size of dimension
-	bool is_ptr;
+	Koopa_value_type typ = KOOPA_VALUE_TYPE_IMMEDIATE;
+	int num = 0;   // the immediate or the temporary
+	Symbol_info const * info = nullptr;
+	int output_ptr(Ost& outstr, std::string prefix) const;
 
 public:
-	std::list<std::variant<int, ExpAST*>> dimension;
-	void set_id(std::string const & str) {
-		id = str + "_" + std::to_string(named_var_cnt);
-		named_var_cnt++;
+	// Indices are only output when it is loaded or stored to.
+	Small_vector<std::variant<int, ExpAST*>, 4> dimension;
+
+	static Koopa_val im(int x) {
+		Koopa_val ret;
+		ret.num = x;
+		return ret;
 	}
-	// dim.size() != max_dep
-	void set_dim(std::list<int> const & dim) {
-		for(int i : dim) {
-			dimension.push_back(i);
-		}
+	static Koopa_val temp(int id) {
+		Koopa_val ret;
+		ret.typ = KOOPA_VALUE_TYPE_TEMP;
+		ret.num = id;
+		return ret;
+	}
+	static Koopa_val named(Symbol_info const * info) {
+		Koopa_val ret;
+		ret.typ = KOOPA_VALUE_TYPE_NAMED;
+		ret.info = info;
+		return ret;
+	}
+	static Koopa_val func(std::string const & id, bool is_void) {
+		auto info = new_symbol_info();
+		info->id = id;
+		info->is_func_void = is_void;
+		Koopa_val ret;
+		ret.typ = KOOPA_VALUE_TYPE_GLOBAL_FUNCTION;
+		ret.info = info;
+		return ret;
 	}
-	void set_dim(std::list<std::unique_ptr<ExpAST>> const & dim) {
+	void set_dim(Ast_list<std::unique_ptr<ExpAST>> const & dim) {
 		for(auto& i : dim) {
 			dimension.push_back(i.get());
 		}
 	}
-	void set_ptr(bool input_is_ptr) { is_ptr = input_is_ptr; }
-	void set_dep(int x) { max_dep = x; }
-	std::string get_id() const { return id; }
-	std::string get_str() const override { return std::string("%") + std::to_string(cache_id); }
-	void prepare(Ost& outstr, std::string prefix) override;
-	Koopa_val_named_symbol* copy() {
-		auto ret = new Koopa_val_named_symbol;
-		*ret = *this;
-		return ret;
-	}
-	void store(std::string&& from, Ost& outstr, std::string prefix);
-	Koopa_value_type val_type() const override { return KOOPA_VALUE_TYPE_NAMED; }
-};
-
-class Koopa_val_global_func : public Koopa_val_base {
-private:
-	bool is_func_void;
-	std::string ident;
-
-public:
-	Koopa_val_global_func(std::string const & id, bool is_void) {
-		is_func_void = is_void;
-		ident = "@" + id;
+	int get_im_val() const {
+		assert(typ == KOOPA_VALUE_TYPE_IMMEDIATE);
+		return num;
 	}
-	Koopa_val_global_func(FuncDefAST const * func) {
-		is_func_void = func->func_typ->is_void;
-		ident = "@" + func->ident;
+	std::string const & get_named_name() const {
+		assert(typ == KOOPA_VALUE_TYPE_NAMED);
+		return info->id;
 	}
-	bool is_void() const { return is_func_void; }
-	std::string get_str() const override { return ident; }
-	Koopa_value_type val_type() const override { return KOOPA_VALUE_TYPE_GLOBAL_FUNCTION; }
-};
-
-class Koopa_val {
-private:
-	std::shared_ptr<Koopa_val_base> val;
-
-public:
-	Koopa_val() {}
-	Koopa_val(Koopa_val const &) = default;
-	Koopa_val(Koopa_val_base* obj) {
-		val = std::shared_ptr<Koopa_val_base>(obj);
+	bool has_index() const {
+		return typ == KOOPA_VALUE_TYPE_NAMED && !dimension.empty();
 	}
-	Koopa_val_base* get_ptr() const { return val.get(); }
-	int get_im_val() const {
-		assert(val_type() == KOOPA_VALUE_TYPE_IMMEDIATE);
-		return std::static_pointer_cast<Koopa_val_im>(val)->get_im_val();
+	// Both are the same scalar variable, not yet loaded.
+	bool is_same_scalar(Koopa_val const & other) const {
+		return typ == KOOPA_VALUE_TYPE_NAMED && other.typ == KOOPA_VALUE_TYPE_NAMED
+			&& info == other.info && !has_index() && !other.has_index();
 	}
-	std::string get_named_name() const {
-		assert(val_type() == KOOPA_VALUE_TYPE_NAMED);
-		return std::static_pointer_cast<Koopa_val_named_symbol>(val)->get_id();
+	Const_array const * get_const_array() const {
+		return typ == KOOPA_VALUE_TYPE_NAMED ? info->const_array.get() : nullptr;
 	}
 	bool is_func_void() const {
-		assert(val->val_type() == KOOPA_VALUE_TYPE_GLOBAL_FUNCTION);
-		return std::static_pointer_cast<Koopa_val_global_func>(val)->is_void();
+		assert(typ == KOOPA_VALUE_TYPE_GLOBAL_FUNCTION);
+		return info->is_func_void;
 	}
-	Koopa_value_type val_type() const { return val->val_type(); }
+	Koopa_value_type val_type() const { return typ; }
 	std::string get_str() const {
-		return val->get_str();
-	}
-	void store(std::string&& from, Ost& outstr, std::string prefix) {
-		if(val_type() == KOOPA_VALUE_TYPE_NAMED) {
-			std::static_pointer_cast<Koopa_val_named_symbol>(val)->store(
-				std::move(from), outstr, prefix);
-			// } else if(val_type() == KOOPA_VALUE_TYPE_PTR) {
-			// 	std::static_pointer_cast<Koopa_val_ptr>(val)->store(
-			// 		std::move(from), outstr, prefix);
-		} else {
-			assert(0);
+		switch(typ) {
+		case KOOPA_VALUE_TYPE_IMMEDIATE: return std::to_string(num);
+		case KOOPA_VALUE_TYPE_TEMP: return "%" + std::to_string(num);
+		case KOOPA_VALUE_TYPE_GLOBAL_FUNCTION: return "@" + info->id;
+		default: assert(0); return "";
 		}
 	}
-	void prepare(Ost& outstr, std::string prefix) {
-		return val->prepare(outstr, prefix);
+	// A name is loaded into a temporary, which it then stands for.
+	void prepare(Ost& outstr, std::string prefix);
+	void store(auto const & from, Ost& outstr, std::string prefix) const {
+		assert(typ == KOOPA_VALUE_TYPE_NAMED);
+		if(dimension.empty()) {
+			outstr << prefix << "store " << from << ", @" << info->id << "\n";
+			return;
+		}
+		int last_ptr = output_ptr(outstr, prefix);
+		outstr << prefix << "store " << from << ", %ptr_" << last_ptr << "\n";
 	}
+	friend Ost& operator<<(Ost& outstr, Koopa_val const & me);
 };
 
 Ost& operator<<(Ost& outstr, Koopa_val const & me) {
-	outstr << me.get_str();
-	return outstr;
+	switch(me.typ) {
+	case KOOPA_VALUE_TYPE_IMMEDIATE: return outstr << me.num;
+	case KOOPA_VALUE_TYPE_TEMP: return outstr << "%" << me.num;
+	case KOOPA_VALUE_TYPE_GLOBAL_FUNCTION: return outstr << "@" << me.info->id;
+	default: assert(0); return outstr;
+	}
 }
 
 }   // namespace Koopa_Val_Def
@@ -187,30 +304,20 @@ std::stack<int> loop_level;
 
 
 namespace Koopa_Val_Def {
-void Koopa_val_named_symbol::prepare(Ost& outstr, std::string prefix) {
-	cache_id = unnamed_var_cnt;
-	unnamed_var_cnt++;
-	if(dimension.empty()) {
-		outstr << prefix << "%" << cache_id << " = ";
-		if(max_dep == 0) {
-			outstr << "load @" << id << "\n";
-		} else {
-			outstr << "getelemptr @" << id << ", 0\n";
-		}
-		return;
-	}
+// Emits the pointers to the element, returns the number of the last one.
+int Koopa_val::output_ptr(Ost& outstr, std::string prefix) const {
 	int last_ptr = -1, now_ptr = -1;
-	bool first_dim = is_ptr;
+	bool first_dim = info->is_ptr;
 	for(auto& i : dimension) {
 		now_ptr = ptr_cnt;
 		ptr_cnt++;
 		if(first_dim) {
 			first_dim = false;
-			outstr << prefix << "%ptr_" << now_ptr << " = load @" << id << "\n";
+			outstr << prefix << "%ptr_" << now_ptr << " = load @" << info->id << "\n";
 			now_ptr = ptr_cnt;
 			ptr_cnt++;
 			if(i.index() == 0) {
-				stmt_val.push(Koopa_val(new Koopa_val_im(std::get<0>(i))));
+				stmt_val.push(Koopa_val::im(std::get<0>(i)));
 			} else {
 				std::get<1>(i)->output(outstr, prefix);
 				stmt_val.top().prepare(outstr, prefix);
@@ -219,14 +326,14 @@ void Koopa_val_named_symbol::prepare(Ost& outstr, std::string prefix) {
 			stmt_val.pop();
 		} else {
 			if(i.index() == 0) {
-				stmt_val.push(Koopa_val(new Koopa_val_im(std::get<0>(i))));
+				stmt_val.push(Koopa_val::im(std::get<0>(i)));
 			} else {
 				std::get<1>(i)->output(outstr, prefix);
 				stmt_val.top().prepare(outstr, prefix);
 			}
 			outstr << prefix << "%ptr_" << now_ptr << " = getelemptr ";
 			if(last_ptr == -1) {
-				outstr << "@" << id;
+				outstr << "@" << info->id;
 			} else {
 				outstr << "%ptr_" << last_ptr;
 			}
@@ -235,62 +342,48 @@ void Koopa_val_named_symbol::prepare(Ost& outstr, std::string prefix) {
 		}
 		last_ptr = now_ptr;
 	}
-	outstr << prefix << "%" << cache_id << " = ";
-	if(max_dep + is_ptr == dimension.size()) {
-		outstr << "load %ptr_" << last_ptr << "\n";
-	} else {
-		outstr << "getelemptr %ptr_" << last_ptr << ", 0\n";
-	}
+	return last_ptr;
 }
 
-void Koopa_val_named_symbol::store(std::string&& from, Ost& outstr, std::string prefix) {
-	if(dimension.empty()) {
-		outstr << prefix << "store " << from << ", @" << id << "\n";
+void Koopa_val::prepare(Ost& outstr, std::string prefix) {
+	if(typ != KOOPA_VALUE_TYPE_NAMED) {
 		return;
 	}
-	int last_ptr = -1, now_ptr = -1;
-	bool first_dim = is_ptr;
-	for(auto& i : dimension) {
-		now_ptr = ptr_cnt;
-		ptr_cnt++;
-		if(first_dim) {
-			first_dim = false;
-			outstr << prefix << "%ptr_" << now_ptr << " = load @" << id << "\n";
-			now_ptr = ptr_cnt;
-			ptr_cnt++;
-			if(i.index() == 0) {
-				stmt_val.push(Koopa_val(new Koopa_val_im(std::get<0>(i))));
-			} else {
-				std::get<1>(i)->output(outstr, prefix);
-				stmt_val.top().prepare(outstr, prefix);
-			}
-			outstr << prefix << "%ptr_" << now_ptr << " = getptr %ptr_" << now_ptr - 1 << ", " << stmt_val.top() << "\n";
-			stmt_val.pop();
+	int cache_id = unnamed_var_cnt;
+	unnamed_var_cnt++;
+	if(dimension.empty()) {
+		outstr << prefix << "%" << cache_id << " = ";
+		if(info->max_dep == 0) {
+			outstr << "load @" << info->id << "\n";
 		} else {
-			if(i.index() == 0) {
-				stmt_val.push(Koopa_val(new Koopa_val_im(std::get<0>(i))));
-			} else {
-				std::get<1>(i)->output(outstr, prefix);
-				stmt_val.top().prepare(outstr, prefix);
-			}
-			outstr << prefix << "%ptr_" << now_ptr << " = getelemptr ";
-			if(last_ptr == -1) {
-				outstr << "@" << id;
-			} else {
-				outstr << "%ptr_" << last_ptr;
-			}
-			outstr << ", " << stmt_val.top() << "\n";
-			stmt_val.pop();
+			outstr << "getelemptr @" << info->id << ", 0\n";
+		}
+	} else {
+		int last_ptr = output_ptr(outstr, prefix);
+		outstr << prefix << "%" << cache_id << " = ";
+		if(info->max_dep + info->is_ptr == (int)dimension.size()) {
+			outstr << "load %ptr_" << last_ptr << "\n";
+		} else {
+			outstr << "getelemptr %ptr_" << last_ptr << ", 0\n";
 		}
-		last_ptr = now_ptr;
 	}
-	outstr << prefix << "store " << from << ", %ptr_" << last_ptr << "\n";
+	*this = temp(cache_id);
 }
 }   // namespace Koopa_Val_Def
 
+// One flat table by identifier id. Each entry keeps the one it shadows, and
+// leaving a scope undoes the entries made in it.
 template<typename T>
 class Symbol_table_stack {
-	std::list<std::unordered_map<std::string, T>> symbols;
+	class Entry {
+	public:
+		T val;
+		int id;
+		int shadowed;
+	};
+	std::vector<int> innermost;   // by identifier id, -1 when not declared
+	std::deque<Entry> entries;
+	std::vector<size_t> scopes;   // where the entries of each scope start
 
 public:
 	Symbol_table_stack() {
@@ -299,32 +392,37 @@ public:
 	~Symbol_table_stack() {
 		del_table();
 	}
-	auto empty_iter() const {
-		return symbols.front().end();
-	}
-	auto find(const std::string& key) {
-		for(auto i = symbols.rbegin(); i != symbols.rend(); i++) {
-			auto val_iter = i->find(key);
-			if(val_iter != i->end()) {
-				return val_iter;
-			}
+	T* find(Ident key) {
+		if(key.id >= (int)innermost.size() || innermost[key.id] == -1) {
+			return nullptr;
 		}
-		return symbols.front().end();
+		return &entries[innermost[key.id]].val;
+	}
+	bool contains(Ident key) { return find(key) != nullptr; }
+	T& operator[](Ident key) {
+		return *find(key);
 	}
-	bool contains(const std::string& key) { return find(key) != empty_iter(); }
-	T& operator[](const std::string& key) {
-		return find(key)->second;
+	void add_table() { scopes.push_back(entries.size()); }
+	void del_table() {
+		while(entries.size() > scopes.back()) {
+			innermost[entries.back().id] = entries.back().shadowed;
+			entries.pop_back();
+		}
+		scopes.pop_back();
 	}
-	void add_table() { symbols.emplace_back(); }
-	void del_table() { symbols.pop_back(); }
-	void insert(std::pair<std::string, T> val) {
-		bool insert_ok = symbols.back().insert(val).second;
-		if(!insert_ok) {
+	void insert(std::pair<Ident, T> val) {
+		int id = val.first.id;
+		if(id >= (int)innermost.size()) {
+			innermost.resize(id + 1, -1);
+		}
+		if(innermost[id] >= (int)scopes.back()) {
 			std::cerr << "It's been a long day without you my friend\n"
 					  << "And I'll tell you all about it when I see you again\n"
 					  << val.first << "\n";
 			throw 114514;
 		}
+		entries.push_back({std::move(val.second), id, innermost[id]});
+		innermost[id] = entries.size() - 1;
 	}
 };
 
@@ -361,20 +459,551 @@ void exit_koopa_block(Ost& outstr, std::string prefix) {
 	outstr.unmute();
 }
 
-void assign_initval_to(auto& me, Koopa_val_named_symbol* val, Ost& outstr, std::string prefix) {
+// Ends the block with a branch on the value just computed.
+void branch_on_value(Ost& outstr, std::string prefix, const std::string& true_label, const std::string& false_label) {
+	auto val = stmt_val.top();
+	stmt_val.pop();
+	val.prepare(outstr, prefix);
+	outstr << prefix << "br " << val << ", " << true_label << ", " << false_label << "\n";
+	outstr.mute();
+	exit_koopa_block(outstr, prefix);
+}
+
+namespace Purity {
+
+// Functions without side effects whose result depends only on their int arguments.
+std::unordered_set<int> pure_functions;   // by identifier id
+
+class Purity_ctx {
+public:
+	Ident func;
+	bool pure = true;
+	bool recursive = false;
+	std::list<std::unordered_set<int>> locals;
+	bool is_local(Ident ident) const {
+		for(auto& i : locals) {
+			if(i.contains(ident.id)) {
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+void check(ExpAST& exp, Purity_ctx& ctx);
+void check(BlockAST& blk, Purity_ctx& ctx);
+void check(StmtAST& stmt, Purity_ctx& ctx);
+
+void check(LValAST& lval, Purity_ctx& ctx) {
+	for(auto& i : *lval.dim_list) {
+		check(*i, ctx);
+	}
+	if(ctx.is_local(lval.ident)) {
+		return;
+	}
+	// Globals are only allowed when they are constants.
+	auto sym = symbol_table.find(lval.ident);
+	if(!sym) {
+		ctx.pure = false;
+		return;
+	}
+	if(sym->val_type() != KOOPA_VALUE_TYPE_IMMEDIATE && !sym->get_const_array()) {
+		ctx.pure = false;
+	}
+}
+
+void check(FuncCallAST& call, Purity_ctx& ctx) {
+	if(call.func == ctx.func) {
+		ctx.recursive = true;
+	} else if(!pure_functions.contains(call.func.id) || ctx.is_local(call.func)) {
+		ctx.pure = false;
+	}
+	for(auto& i : call.params->params) {
+		check(*i, ctx);
+	}
+}
+
+void check(ExpAST& exp, Purity_ctx& ctx) {
+	for(auto& i : exp.nodes) {
+		if(i.typ == EXP_LVAL) {
+			check(*i.lval, ctx);
+		} else if(i.typ == EXP_CALL) {
+			check(*i.call, ctx);
+		}
+	}
+}
+
+void check(DeclAST& decl, Purity_ctx& ctx) {
+	if(decl.decl.index() == 0) {
+		// const initializers are constant expressions
+		for(auto& i : std::get<0>(decl.decl)->defs) {
+			ctx.locals.back().insert(i->ident.id);
+		}
+		return;
+	}
+	for(auto& i : std::get<1>(decl.decl)->defs) {
+		if(!i->dim_list->empty()) {
+			ctx.pure = false;
+		}
+		if(i->val.has_value() && i->val.value()->exp.index() == 0) {
+			check(*std::get<0>(i->val.value()->exp), ctx);
+		}
+		ctx.locals.back().insert(i->ident.id);
+	}
+}
+
+void check(StmtAST& stmt, Purity_ctx& ctx) {
+	switch(stmt.val.index()) {
+	case 0: {
+		auto& ret = std::get<0>(stmt.val);
+		if(ret->exp->has_value()) {
+			check(*ret->exp->exp.value(), ctx);
+		}
+		break;
+	}
+	case 1: {
+		auto& assign = std::get<1>(stmt.val);
+		if(!ctx.is_local(assign->lval->ident) || !assign->lval->dim_list->empty()) {
+			ctx.pure = false;
+		}
+		check(*assign->exp, ctx);
+		break;
+	}
+	case 2: {
+		auto& exp = std::get<2>(stmt.val);
+		if(exp->has_value()) {
+			check(*exp->exp.value(), ctx);
+		}
+		break;
+	}
+	case 3: check(*std::get<3>(stmt.val), ctx); break;
+	case 4: {
+		auto& if_ast = std::get<4>(stmt.val);
+		check(*if_ast->cond, ctx);
+		check(*if_ast->if_stmt, ctx);
+		if(if_ast->else_stmt.has_value()) {
+			check(*if_ast->else_stmt.value(), ctx);
+		}
+		break;
+	}
+	case 5: {
+		auto& while_ast = std::get<5>(stmt.val);
+		check(*while_ast->cond, ctx);
+		check(*while_ast->stmt, ctx);
+		break;
+	}
+	default:;
+	}
+}
+
+void check(BlockAST& blk, Purity_ctx& ctx) {
+	ctx.locals.emplace_back();
+	for(auto& i : blk.items) {
+		if(i->item.index() == 0) {
+			check(*std::get<0>(i->item), ctx);
+		} else {
+			check(*std::get<1>(i->item), ctx);
+		}
+	}
+	ctx.locals.pop_back();
+}
+
+// A function may be memoized when it returns int, takes only int parameters,
+// touches no globals or arrays, calls only pure functions and calls itself.
+bool is_memoizable(FuncDefAST& func) {
+	Purity_ctx ctx;
+	ctx.func = func.ident;
+	ctx.locals.emplace_back();
+	if(func.params.has_value()) {
+		for(auto& i : func.params.value()->params) {
+			if(i->is_ptr) {
+				ctx.pure = false;
+			}
+			ctx.locals.back().insert(i->id.id);
+		}
+	}
+	check(*func.block, ctx);
+	if(func.func_typ->is_void) {
+		ctx.pure = false;
+	}
+	if(ctx.pure) {
+		pure_functions.insert(func.ident.id);
+	}
+	return ctx.pure && ctx.recursive && func.params.has_value();
+}
+
+}   // namespace Purity
+
+namespace Memoize {
+
+constexpr int TABLE_SIZE = 1024;   // entries per function, must be a power of two
+constexpr int HASH_MUL = 31;
+
+// Result cache of the function being emitted. An entry is {valid, result, args...}.
+class Memo_table {
+public:
+	std::string table;
+	std::string entry;   // pointer to the entry of the current arguments
+	std::list<std::string> args;
+};
+
+std::optional<Memo_table> cur_memo;
+
+std::string elem_ptr(Ost& outstr, std::string prefix, std::string const & src, int index) {
+	std::string ptr = "%ptr_" + std::to_string(ptr_cnt);
+	ptr_cnt++;
+	outstr << prefix << ptr << " = getelemptr " << src << ", " << index << "\n";
+	return ptr;
+}
+
+std::string new_temp() {
+	std::string tmp = "%" + std::to_string(unnamed_var_cnt);
+	unnamed_var_cnt++;
+	return tmp;
+}
+
+// Emits the lookup at function entry: a hit returns the cached result,
+// a miss falls through into the original body.
+void output_lookup(Ost& outstr, std::string prefix) {
+	auto& memo = cur_memo.value();
+	int memo_id = if_cnt;
+	if_cnt++;
+	// arguments live in caller-saved registers, keep a copy for the save after calls
+	for(auto& i : memo.args) {
+		std::string arg = new_temp();
+		outstr << prefix << arg << " = add " << i << ", 0\n";
+		i = arg;
+	}
+	std::string hash;
+	for(auto& i : memo.args) {
+		if(hash.empty()) {
+			hash = i;
+			continue;
+		}
+		std::string mul = new_temp(), add = new_temp();
+		outstr << prefix << mul << " = mul " << hash << ", " << HASH_MUL << "\n"
+			   << prefix << add << " = add " << mul << ", " << i << "\n";
+		hash = add;
+	}
+	std::string index = new_temp();
+	outstr << prefix << index << " = and " << hash << ", " << TABLE_SIZE - 1 << "\n";
+	memo.entry = "%ptr_" + std::to_string(ptr_cnt);
+	ptr_cnt++;
+	outstr << prefix << memo.entry << " = getelemptr " << memo.table << ", " << index << "\n";
+	std::string valid_ptr = elem_ptr(outstr, prefix, memo.entry, 0);
+	std::string valid = new_temp();
+	outstr << prefix << valid << " = load " << valid_ptr << "\n";
+	std::string check_blk = "%memo_check" + std::to_string(memo_id);
+	std::string hit_blk = "%memo_hit" + std::to_string(memo_id);
+	std::string miss_blk = "%memo_miss" + std::to_string(memo_id);
+	outstr << prefix << "br " << valid << ", " << check_blk << ", " << miss_blk << "\n";
+	enter_koopa_block(check_blk, outstr, prefix);
+	std::string all_eq;
+	int key_index = 2;
+	for(auto& i : memo.args) {
+		std::string key_ptr = elem_ptr(outstr, prefix, memo.entry, key_index);
+		std::string key = new_temp(), eq = new_temp();
+		outstr << prefix << key << " = load " << key_ptr << "\n"
+			   << prefix << eq << " = eq " << key << ", " << i << "\n";
+		key_index++;
+		if(all_eq.empty()) {
+			all_eq = eq;
+		} else {
+			std::string both = new_temp();
+			outstr << prefix << both << " = and " << all_eq << ", " << eq << "\n";
+			all_eq = both;
+		}
+	}
+	outstr << prefix << "br " << all_eq << ", " << hit_blk << ", " << miss_blk << "\n";
+	enter_koopa_block(hit_blk, outstr, prefix);
+	std::string result_ptr = elem_ptr(outstr, prefix, memo.entry, 1);
+	std::string result = new_temp();
+	outstr << prefix << result << " = load " << result_ptr << "\n"
+		   << prefix << "ret " << result << "\n";
+	enter_koopa_block(miss_blk, outstr, prefix);
+}
+
+void output_save(Ost& outstr, std::string prefix, std::string const & result) {
+	auto& memo = cur_memo.value();
+	std::string ptr = elem_ptr(outstr, prefix, memo.entry, 1);
+	outstr << prefix << "store " << result << ", " << ptr << "\n";
+	int key_index = 2;
+	for(auto& i : memo.args) {
+		ptr = elem_ptr(outstr, prefix, memo.entry, key_index);
+		outstr << prefix << "store " << i << ", " << ptr << "\n";
+		key_index++;
+	}
+	ptr = elem_ptr(outstr, prefix, memo.entry, 0);
+	outstr << prefix << "store 1, " << ptr << "\n";
+}
+
+}   // namespace Memoize
+
+namespace Array_Init {
+
+constexpr int ZERO_FILL_MIN = 16;       // zero elements from which a local array is cleared by a loop
+constexpr int TEMPLATE_INIT_MIN = 256;   // constant elements from which it is copied from a .rodata template
+
+// How a local array is filled before the remaining elements are stored one by one.
+enum Init_fill {
+	FILL_NONE,
+	FILL_ZERO,       // cleared, the non-zero elements follow
+	FILL_TEMPLATE,   // copied from its constant part, the non-constant elements follow
+};
+
+// The elements of a zero-filled initializer row-major, non-constant ones as 0.
+class Init_data {
+public:
+	std::vector<int> data;
+	int zeros = 0, consts = 0;   // zero, and constant but not zero
+};
+
+void flatten_initval(InitValAST* me, std::list<int> const & dim, Init_data& out) {
+	int total = 1;
+	for(int i : dim) {
+		total *= i;
+	}
+	if(me->is_zero) {
+		out.data.resize(out.data.size() + total, 0);
+		out.zeros += total;
+		return;
+	}
+	if(me->exp.index() == 0) {
+		auto& exp = std::get<0>(me->exp);
+		bool is_const = exp->is_const_exp();
+		int val = is_const ? exp->calc() : 0;
+		out.data.push_back(val);
+		out.zeros += is_const && val == 0;
+		out.consts += val != 0;
+		return;
+	}
+	std::list<int> sub_dim(dim.empty() ? dim.begin() : ++dim.begin(), dim.end());
+	for(auto& i : std::get<1>(me->exp)) {
+		flatten_initval(i.get(), sub_dim, out);
+	}
+}
+
+void output_aggregate(Ost& outstr, std::vector<int> const & data, std::list<int>::const_iterator dim,
+					  std::list<int>::const_iterator dim_end, size_t& pos) {
+	if(dim == dim_end) {
+		outstr << data[pos];
+		pos++;
+		return;
+	}
+	int len = *dim;
+	dim++;
+	outstr << "{";
+	for(int i = 0; i < len; i++) {
+		if(i > 0) {
+			outstr << ", ";
+		}
+		output_aggregate(outstr, data, dim, dim_end, pos);
+	}
+	outstr << "}";
+}
+
+// Pointer to the first int of an array named name of shape dim.
+std::string first_int(std::string const & name, std::list<int> const & dim, Ost& outstr, std::string prefix) {
+	std::string base = name;
+	for(size_t i = 0; i < dim.size(); i++) {
+		base = Memoize::elem_ptr(outstr, prefix, base, 0);
+	}
+	return base;
+}
+
+// Fills every element of a local array with one counted loop over its ints,
+// copied from the array src or zero when src is empty, instead of a
+// getelemptr chain and a store per element.
+void output_fill(Koopa_val const & val, std::list<int> const & dim, std::string const & src, Ost& outstr,
+				 std::string prefix) {
+	int cur_loop_cnt = loop_cnt;
+	loop_cnt++;
+	std::string base = first_int("@" + val.get_named_name(), dim, outstr, prefix);
+	std::string src_base = src.empty() ? "" : first_int(src, dim, outstr, prefix);
+	int total = 1;
+	for(int i : dim) {
+		total *= i;
+	}
+	std::string idx = "%fill_idx" + std::to_string(cur_loop_cnt);
+	std::string entry = "%fill_entry" + std::to_string(cur_loop_cnt);
+	std::string body = "%fill_body" + std::to_string(cur_loop_cnt);
+	std::string end = "%fill_end" + std::to_string(cur_loop_cnt);
+	outstr << prefix << idx << " = alloc i32\n"
+		   << prefix << "store 0, " << idx << "\n"
+		   << prefix << "jump " << entry << "\n";
+	outstr.mute();
+	exit_koopa_block(outstr, prefix);
+	enter_koopa_block(entry, outstr, prefix);
+	std::string i = Memoize::new_temp(), more = Memoize::new_temp();
+	outstr << prefix << i << " = load " << idx << "\n"
+		   << prefix << more << " = lt " << i << ", " << total << "\n"
+		   << prefix << "br " << more << ", " << body << ", " << end << "\n";
+	outstr.mute();
+	exit_koopa_block(outstr, prefix);
+	enter_koopa_block(body, outstr, prefix);
+	std::string elem = "0";
+	if(!src.empty()) {
+		std::string src_ptr = "%ptr_" + std::to_string(ptr_cnt);
+		ptr_cnt++;
+		elem = Memoize::new_temp();
+		outstr << prefix << src_ptr << " = getptr " << src_base << ", " << i << "\n"
+			   << prefix << elem << " = load " << src_ptr << "\n";
+	}
+	std::string ptr = "%ptr_" + std::to_string(ptr_cnt), nxt = Memoize::new_temp();
+	ptr_cnt++;
+	outstr << prefix << ptr << " = getptr " << base << ", " << i << "\n"
+		   << prefix << "store " << elem << ", " << ptr << "\n"
+		   << prefix << nxt << " = add " << i << ", 1\n"
+		   << prefix << "store " << nxt << ", " << idx << "\n"
+		   << prefix << "jump " << entry << "\n";
+	outstr.mute();
+	exit_koopa_block(outstr, prefix);
+	enter_koopa_block(end, outstr, prefix);
+}
+
+// Fills a local array in bulk when enough of its initializer is constant. A
+// template copy costs a load and a store per element, clearing costs a store
+// per element plus a getelemptr and a store per element set afterwards. Small
+// initializers are left to inline stores, which run faster than a copy of the
+// same length and only cost code size.
+Init_fill output_bulk_init(Koopa_val const & val, InitValAST* init, std::list<int> const & dim, Ost& outstr,
+						   std::string prefix) {
+	// in dead code nothing is output: the fill loop would unmute it, and a
+	// template would be written for a declaration that is never emitted
+	if(dim.empty() || outstr.muted) {
+		return FILL_NONE;
+	}
+	Init_data init_data;
+	flatten_initval(init, dim, init_data);
+	if(init_data.consts >= TEMPLATE_INIT_MIN && init_data.zeros < 2 * init_data.consts) {
+		// emitted once next to the function, like local const arrays
+		std::string name = val.get_named_name() + "_init";
+		hoisted_globals << "global @" << name << " = alloc ";
+		for(size_t i = dim.size(); i-- > 0;) {
+			hoisted_globals << "[";
+		}
+		hoisted_globals << "i32";
+		for(auto i = dim.rbegin(); i != dim.rend(); i++) {
+			hoisted_globals << ", " << *i << "]";
+		}
+		hoisted_globals << ", ";
+		size_t pos = 0;
+		output_aggregate(hoisted_globals, init_data.data, dim.begin(), dim.end(), pos);
+		hoisted_globals << "\n";
+		readonly_globals.insert(name);
+		output_fill(val, dim, "@" + name, outstr, prefix);
+		return FILL_TEMPLATE;
+	}
+	if(init_data.zeros >= ZERO_FILL_MIN) {
+		output_fill(val, dim, "", outstr, prefix);
+		return FILL_ZERO;
+	}
+	return FILL_NONE;
+}
+
+}   // namespace Array_Init
+
+namespace Simplify {
+
+bool is_im(Koopa_val const & val, int x) {
+	return val.val_type() == KOOPA_VALUE_TYPE_IMMEDIATE && val.get_im_val() == x;
+}
+
+// Wraps at 32 bits like the target does. Division by zero and its overflow are
+// left to run.
+std::optional<int> fold(Op_type op, int lhs, int rhs) {
+	uint32_t ul = lhs, ur = rhs;
+	switch(op) {
+	case OP_ADD: return ul + ur;
+	case OP_SUB: return ul - ur;
+	case OP_MUL: return ul * ur;
+	case OP_DIV:
+	case OP_MOD:
+		if(rhs == 0 || (lhs == INT32_MIN && rhs == -1)) {
+			return std::nullopt;
+		}
+		return op == OP_DIV ? lhs / rhs : lhs % rhs;
+	case OP_GT: return lhs > rhs;
+	case OP_GE: return lhs >= rhs;
+	case OP_LT: return lhs < rhs;
+	case OP_LE: return lhs <= rhs;
+	case OP_EQ: return lhs == rhs;
+	case OP_NEQ: return lhs != rhs;
+	default: return std::nullopt;
+	}
+}
+
+// The value of lhs op rhs when it needs no instruction. Both are already
+// output but not loaded, so a plain operand can stand for the result.
+std::optional<Koopa_val> binary(Op_type op, Koopa_val const & lhs, Koopa_val const & rhs) {
+	if(lhs.val_type() == KOOPA_VALUE_TYPE_IMMEDIATE && rhs.val_type() == KOOPA_VALUE_TYPE_IMMEDIATE) {
+		if(auto ret = fold(op, lhs.get_im_val(), rhs.get_im_val())) {
+			return Koopa_val::im(*ret);
+		}
+		return std::nullopt;
+	}
+	if(lhs.is_same_scalar(rhs)) {
+		switch(op) {
+		case OP_SUB:
+		case OP_NEQ:
+		case OP_LT:
+		case OP_GT:
+			return Koopa_val::im(0);
+		case OP_EQ:
+		case OP_LE:
+		case OP_GE:
+			return Koopa_val::im(1);
+		default:;
+		}
+	}
+	switch(op) {
+	case OP_ADD:
+		if(is_im(lhs, 0)) return rhs;
+		if(is_im(rhs, 0)) return lhs;
+		break;
+	case OP_SUB:
+		if(is_im(rhs, 0)) return lhs;
+		break;
+	case OP_MUL:
+		// the index of an element may call functions, so it is still loaded
+		if((is_im(lhs, 0) && !rhs.has_index()) || (is_im(rhs, 0) && !lhs.has_index())) {
+			return Koopa_val::im(0);
+		}
+		if(is_im(lhs, 1)) return rhs;
+		if(is_im(rhs, 1)) return lhs;
+		break;
+	case OP_DIV:
+		if(is_im(rhs, 1)) return lhs;
+		break;
+	case OP_MOD:
+		if((is_im(rhs, 1) || is_im(rhs, -1)) && !lhs.has_index()) return Koopa_val::im(0);
+		break;
+	default:;
+	}
+	return std::nullopt;
+}
+
+}   // namespace Simplify
+
+// filled: what the array holds already, only the other elements are stored.
+void assign_initval_to(auto& me, Koopa_val& val, Ost& outstr, std::string prefix,
+					   Array_Init::Init_fill filled = Array_Init::FILL_NONE) {
 	me->prepare_dim();
 	if(me->is_zero) {
+		if(filled != Array_Init::FILL_NONE) {
+			return;
+		}
 		if(me->dimension.empty()) {
-			val->store("0", outstr, prefix);
+			val.store("0", outstr, prefix);
 			return;
 		}
 		for(int i = me->dimension.size(); i-- > 0;) {
-			val->dimension.push_back(0);
+			val.dimension.push_back(0);
 		}
 		for(;;) {
-			val->store("0", outstr, prefix);
+			val.store("0", outstr, prefix);
 			auto i = me->dimension.rbegin();
-			auto j = val->dimension.rbegin();
+			auto j = val.dimension.rbegin();
 			++std::get<0>(*j);
 			while(*i == std::get<0>(*j)) {
 				*j = 0;
@@ -390,27 +1019,32 @@ void assign_initval_to(auto& me, Koopa_val_named_symbol* val, Ost& outstr, std::
 			}
 		}
 		for(int i = me->dimension.size(); i-- > 0;) {
-			val->dimension.pop_back();
+			val.dimension.pop_back();
 		}
 		return;
 	}
 	if(me->exp.index() == 0) {
-		std::get<0>(me->exp)->output(outstr, prefix);
+		auto& exp = std::get<0>(me->exp);
+		if(filled != Array_Init::FILL_NONE && exp->is_const_exp() &&
+		   (filled == Array_Init::FILL_TEMPLATE || exp->calc() == 0)) {
+			return;
+		}
+		exp->output(outstr, prefix);
 		Koopa_val las = stmt_val.top();
 		stmt_val.pop();
 		las.prepare(outstr, prefix);
-		val->store(las.get_str(), outstr, prefix);
+		val.store(las, outstr, prefix);
 		return;
 	}
-	val->dimension.push_back(0);
+	val.dimension.push_back(0);
 	for(auto& i : std::get<1>(me->exp)) {
 		if(me->dimension.size() > 1) {
 			i->dimension = std::list<int>(++me->dimension.begin(), me->dimension.end());
 		}
-		assign_initval_to(i, val, outstr, prefix);
-		std::get<0>(val->dimension.back())++;
+		assign_initval_to(i, val, outstr, prefix, filled);
+		std::get<0>(val.dimension.back())++;
 	}
-	val->dimension.pop_back();
+	val.dimension.pop_back();
 }
 
 template<typename Me_type>
@@ -424,7 +1058,7 @@ void fill_zero_base(Me_type* me, std::list<int> const & dim) {
 	if(me->is_zero) {
 		return;
 	}
-	std::list<std::unique_ptr<Me_type>> nxt_exp;
+	Ast_list<std::unique_ptr<Me_type>> nxt_exp;
 	int done = 0;
 	std::list<int> sum_size = dim;
 	sum_size.push_back(1);
@@ -495,9 +1129,27 @@ void fill_zero_base(Me_type* me, std::list<int> const & dim) {
 	me->exp = std::move(nxt_exp);
 }
 
-namespace Ast_Defs {
+// Append the values of a zero-filled const initializer to `out`, row-major.
+void flatten_const_initval(ConstInitValAST* me, std::list<int> const & dim, std::vector<int>& out) {
+	if(!me->is_zero && me->exp.index() == 0) {
+		out.push_back(std::get<0>(me->exp)->calc());
+		return;
+	}
+	size_t total = 1;
+	for(int i : dim) {
+		total *= i;
+	}
+	size_t start = out.size();
+	if(!me->is_zero) {
+		std::list<int> sub_dim(dim.empty() ? dim.begin() : ++dim.begin(), dim.end());
+		for(auto& i : std::get<1>(me->exp)) {
+			flatten_const_initval(i.get(), sub_dim, out);
+		}
+	}
+	out.resize(start + total, 0);
+}
 
-template class BinaryExpAST_Base<BinaryExpAST<0>, UnaryExpAST>;
+namespace Ast_Defs {
 
 void Dimension_list::prepare_dim() {
 	if(dim_list) {
@@ -509,7 +1161,9 @@ void Dimension_list::prepare_dim() {
 	}
 }
 
-void CompUnitAST::output(Ost& outstr, std::string prefix) {
+std::function<void(CompUnitAST&)> top_level_hook;
+
+void CompUnitAST::output_lib_decls(Ost& outstr) {
 	outstr << R"(decl @getint(): i32
 decl @getch(): i32
 decl @getarray(*i32): i32
@@ -520,27 +1174,45 @@ decl @starttime()
 decl @stoptime()
 
 )";
+}
+
+void CompUnitAST::enter_global_scope() {
 	enter_sysy_block();
 	for(auto [func_id, is_void] : Sysy_Library::sysy_lib_funcs) {
-		symbol_table.insert({func_id, Koopa_val(new Koopa_val_global_func(func_id, is_void))});
+		symbol_table.insert({intern(func_id), Koopa_val::func(func_id, is_void)});
+	}
+}
+
+void CompUnitAST::exit_global_scope() {
+	exit_sysy_block();
+}
+
+void CompUnitAST::output_item(VariantAstPtr<FuncDefAST, DeclAST>& item, Ost& outstr, std::string prefix) {
+	switch(item.index()) {
+	case 0:
+		std::get<0>(item)->output(outstr, prefix);
+		break;
+	case 1:
+		std::get<1>(item)->output_global(outstr, prefix);
+		break;
+	default:;
 	}
+}
+
+void CompUnitAST::output(Ost& outstr, std::string prefix) {
+	output_lib_decls(outstr);
+	enter_global_scope();
 	for(auto& i : decls) {
-		switch(i.index()) {
-		case 0:
-			std::get<0>(i)->output(outstr, prefix);
-			break;
-		case 1:
-			std::get<1>(i)->output_global(outstr, prefix);
-			break;
-		default:;
-		}
+		output_item(i, outstr, prefix);
 	}
-	exit_sysy_block();
+	exit_global_scope();
 }
 
-void FuncDefAST::output(Ost& outstr, std::string prefix) {
-	symbol_table.insert({ident, Koopa_val(new Koopa_val_global_func(this))});
+void FuncDefAST::output(Ost& global_outstr, std::string prefix) {
+	symbol_table.insert({ident, Koopa_val::func(ident.str(), func_typ->is_void)});
 	enter_sysy_block();
+	std::ostringstream func_buf;
+	Ost outstr(func_buf);
 	outstr << prefix << "fun @" << ident << "(";
 	if(params.has_value()) {
 		params.value()->output(outstr, "");
@@ -555,6 +1227,20 @@ void FuncDefAST::output(Ost& outstr, std::string prefix) {
 	if(params.has_value()) {
 		params.value()->output_save(outstr, prefix + INDENT);
 	}
+	if(Options::memoize_pure && Purity::is_memoizable(*this)) {
+		Memoize::Memo_table memo;
+		memo.table = "@__memo_" + ident.str();
+		for(auto& i : params.value()->params) {
+			memo.args.push_back("@" + i->id.str() + "_param");
+		}
+		hoisted_globals << "global " << memo.table << " = alloc [[i32, " << memo.args.size() + 2 << "], "
+						<< Memoize::TABLE_SIZE << "], zeroinit\n";
+		Memoize::cur_memo = memo;
+		Memoize::output_lookup(outstr, prefix + INDENT);
+		if(Options::opt_report) {
+			std::cerr << "memoize-pure: @" << ident << " uses a " << Memoize::TABLE_SIZE << "-entry result cache\n";
+		}
+	}
 	block->output_base(outstr, prefix, false);
 	if(!outstr.muted && func_typ->is_void) {
 		outstr << prefix + INDENT << "ret\n";
@@ -563,6 +1249,9 @@ void FuncDefAST::output(Ost& outstr, std::string prefix) {
 	exit_koopa_block(outstr, prefix);
 	outstr << prefix << "}\n";
 	exit_sysy_block();
+	Memoize::cur_memo.reset();
+	global_outstr << hoisted_globals_buf.str() << func_buf.str();
+	hoisted_globals_buf.str("");
 }
 
 void TypeAST::output(Ost& outstr, std::string prefix) {
@@ -612,135 +1301,49 @@ void OptionalExpAST::output(Ost& outstr, std::string prefix) {
 	}
 }
 
-void ExpAST::output(Ost& outstr, std::string prefix) {
-	binary_exp->output(outstr, prefix);
-}
-
-int ExpAST::calc() {
-	return binary_exp->calc();
-}
-
-void UnaryExpAST::output(Ost& outstr, std::string prefix) {
-	if(unary_op.has_value()) {
-		// unary_exp
-		std::get<0>(unary_exp)->output(outstr, prefix);
-		int now_var = unnamed_var_cnt;
-		unnamed_var_cnt++;
-		stmt_val.top().prepare(outstr, prefix);
-		outstr << prefix << "%" << now_var << " = ";
-		(*unary_op)->output(outstr, "");
-		outstr << stmt_val.top() << "\n";
-		stmt_val.pop();
-		stmt_val.push(new Koopa_val_temp_symbol(now_var));
-	} else {
-		// primary_exp
-		std::get<1>(unary_exp)->output(outstr, prefix);
-	}
-}
-
-int UnaryExpAST::calc() {
-	if(unary_op.has_value()) {
-		return unary_op.value()->calc(std::get<0>(unary_exp)->calc());
-	} else {
-		return std::get<1>(unary_exp)->calc();
-	}
-}
-
-void PrimaryExpAST::output(Ost& outstr, std::string prefix) {
-	switch(inside_exp.index()) {
-	case 0:
-		std::get<0>(inside_exp)->output(outstr, prefix);
-		break;
-	case 1:
-		std::get<1>(inside_exp)->output(outstr, prefix);
-		break;
-	case 2:
-		stmt_val.push(new Koopa_val_im(std::get<2>(inside_exp)));
-		break;
-	default:;
-	}
-}
-
-int PrimaryExpAST::calc() {
-	switch(inside_exp.index()) {
-	case 0:
-		return std::get<0>(inside_exp)->calc();
-		break;
-	case 1: {
-		std::string& ident = std::get<1>(inside_exp)->ident;
-		if(!symbol_table.contains(ident)) {
-			std::cerr << "not find " << ident << " in symbol_table\n";
-			throw 114514;
-		}
-		return symbol_table[ident].get_im_val();
-		break;
-	}
-	case 2:
-		return std::get<2>(inside_exp);
-		break;
-	default: assert(0);
-	}
+bool is_logic_op(Op_type op) {
+	return op == OP_LAND || op == OP_LOR;
 }
 
-void UnaryOpAST::output(Ost& outstr, std::string prefix) {
-	outstr << prefix;
+// The instruction of an operator, up to its operands.
+const char* unary_inst(Op_type op) {
 	switch(op) {
-	case OP_ADD:
-		outstr << "add 0, ";
-		break;
-	case OP_SUB:
-		outstr << "sub 0, ";
-		break;
-	case OP_LNOT:
-		outstr << "eq 0, ";
-		break;
-	default:
-		assert(0);
-		break;
+	case OP_ADD: return "add 0, ";
+	case OP_SUB: return "sub 0, ";
+	case OP_LNOT: return "eq 0, ";
+	default: assert(0);
 	}
 }
 
-int UnaryOpAST::calc(int x) {
+const char* binary_inst(Op_type op) {
 	switch(op) {
-	case OP_ADD:
-		return x;
-		break;
-	case OP_SUB:
-		return -x;
-		break;
-	case OP_LNOT:
-		return !x;
-		break;
-	default:
-		assert(0);
+	case OP_ADD: return "add ";
+	case OP_SUB: return "sub ";
+	case OP_MUL: return "mul ";
+	case OP_DIV: return "div ";
+	case OP_MOD: return "mod ";
+	case OP_GT: return "gt ";
+	case OP_GE: return "ge ";
+	case OP_LT: return "lt ";
+	case OP_LE: return "le ";
+	case OP_EQ: return "eq ";
+	case OP_NEQ: return "ne ";
+	case OP_LAND: return "and ";
+	case OP_LOR: return "or ";
+	default: assert(0);
 	}
 }
 
-bool BinaryOpAST::is_logic_op() {
-	return op == OP_LAND || op == OP_LOR;
-}
-
-void BinaryOpAST::output(Ost& outstr, std::string prefix) {
-	outstr << prefix;
+int calc_unary(Op_type op, int x) {
 	switch(op) {
-	case OP_ADD: outstr << "add "; break;
-	case OP_SUB: outstr << "sub "; break;
-	case OP_MUL: outstr << "mul "; break;
-	case OP_DIV: outstr << "div "; break;
-	case OP_MOD: outstr << "mod "; break;
-	case OP_GT: outstr << "gt "; break;
-	case OP_GE: outstr << "ge "; break;
-	case OP_LT: outstr << "lt "; break;
-	case OP_LE: outstr << "le "; break;
-	case OP_EQ: outstr << "eq "; break;
-	case OP_NEQ: outstr << "ne "; break;
-	case OP_LAND: outstr << "and "; break;
-	case OP_LOR: outstr << "or "; break;
+	case OP_ADD: return x;
+	case OP_SUB: return -(uint32_t)x;
+	case OP_LNOT: return !x;
 	default: assert(0);
 	}
 }
 
-int BinaryOpAST::calc(int lhs, int rhs) {
+int calc_binary(Op_type op, int lhs, int rhs) {
 	switch(op) {
 	case OP_ADD: return lhs + rhs;
 	case OP_SUB: return lhs - rhs;
@@ -759,89 +1362,218 @@ int BinaryOpAST::calc(int lhs, int rhs) {
 	}
 }
 
-template<typename T, typename U>
-void BinaryExpAST_Base<T, U>::output(Ost& outstr, std::string prefix) {
-	if(!binary_op.has_value()) {
-		return nxt_level->output(outstr, prefix);
+ExpAST* ExpAST::number(int val) {
+	auto ret = new ExpAST();
+	auto& node = ret->nodes.emplace_back();
+	node.typ = EXP_NUMBER;
+	node.val = val;
+	return ret;
+}
+
+ExpAST* ExpAST::lval(LValAST* lval) {
+	auto ret = new ExpAST();
+	auto& node = ret->nodes.emplace_back();
+	node.typ = EXP_LVAL;
+	node.lval.reset(lval);
+	return ret;
+}
+
+ExpAST* ExpAST::call(FuncCallAST* call) {
+	auto ret = new ExpAST();
+	auto& node = ret->nodes.emplace_back();
+	node.typ = EXP_CALL;
+	node.call.reset(call);
+	return ret;
+}
+
+ExpAST* ExpAST::unary(Op_type op, ExpAST* exp) {
+	auto& node = exp->nodes.emplace_back();
+	node.typ = EXP_UNARY;
+	node.op = op;
+	return exp;
+}
+
+ExpAST* ExpAST::binary(Op_type op, ExpAST* lhs, ExpAST* rhs) {
+	int offset = lhs->nodes.size();
+	for(auto& i : rhs->nodes) {
+		i.begin += offset;
+		lhs->nodes.push_back(std::move(i));
+	}
+	delete rhs;
+	auto& node = lhs->nodes.emplace_back();
+	node.typ = EXP_BINARY;
+	node.op = op;
+	return lhs;
+}
+
+void ExpAST::output(Ost& outstr, std::string prefix) {
+	output_node(nodes.size() - 1, outstr, prefix);
+}
+
+// Branches to true_label or false_label by the value, which is never materialized
+// when it is made of && and ||.
+void ExpAST::output_cond(Ost& outstr, std::string prefix, const std::string& true_label, const std::string& false_label) {
+	output_cond_node(nodes.size() - 1, outstr, prefix, true_label, false_label);
+}
+
+int ExpAST::calc() {
+	std::vector<int> vals;
+	for(auto& i : nodes) {
+		switch(i.typ) {
+		case EXP_NUMBER:
+			vals.push_back(i.val);
+			break;
+		case EXP_LVAL:
+			vals.push_back(i.lval->calc());
+			break;
+		case EXP_CALL:
+			vals.push_back(i.call->calc());
+			break;
+		case EXP_UNARY:
+			vals.back() = calc_unary(i.op, vals.back());
+			break;
+		case EXP_BINARY: {
+			int rhs = vals.back();
+			vals.pop_back();
+			vals.back() = calc_binary(i.op, vals.back(), rhs);
+			break;
+		}
+		}
+	}
+	return vals.back();
+}
+
+bool ExpAST::is_const_exp() {
+	for(auto& i : nodes) {
+		if(i.typ == EXP_CALL || (i.typ == EXP_LVAL && !i.lval->is_const_exp())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void ExpAST::output_node(int i, Ost& outstr, std::string prefix) {
+	auto& node = nodes[i];
+	switch(node.typ) {
+	case EXP_NUMBER:
+		stmt_val.push(Koopa_val::im(node.val));
+		break;
+	case EXP_LVAL:
+		node.lval->output(outstr, prefix);
+		break;
+	case EXP_CALL:
+		node.call->output(outstr, prefix);
+		break;
+	case EXP_UNARY:
+		output_unary(i, outstr, prefix);
+		break;
+	case EXP_BINARY:
+		output_binary(i, outstr, prefix);
+		break;
+	}
+}
+
+void ExpAST::output_unary(int i, Ost& outstr, std::string prefix) {
+	auto op = nodes[i].op;
+	int inner = i - 1;
+	if(op == OP_ADD) {
+		return output_node(inner, outstr, prefix);
 	}
-	if(binary_op.value()->is_logic_op()) {
-		now_level.value()->output(outstr, prefix);
-		Koopa_val lhs = stmt_val.top();
+	// !!x is x != 0 and -(-x) is x
+	bool twice = nodes[inner].typ == EXP_UNARY && nodes[inner].op == op;
+	output_node(twice ? inner - 1 : inner, outstr, prefix);
+	if(twice && op == OP_SUB) {
+		return;
+	}
+	if(stmt_val.top().val_type() == KOOPA_VALUE_TYPE_IMMEDIATE) {
+		int x = stmt_val.top().get_im_val();
 		stmt_val.pop();
-		lhs.prepare(outstr, prefix);
+		stmt_val.push(Koopa_val::im(twice ? x != 0 : calc_unary(op, x)));
+		return;
+	}
+	int now_var = unnamed_var_cnt;
+	unnamed_var_cnt++;
+	stmt_val.top().prepare(outstr, prefix);
+	outstr << prefix << "%" << now_var << " = " << (twice ? "ne 0, " : unary_inst(op)) << stmt_val.top() << "\n";
+	stmt_val.pop();
+	stmt_val.push(Koopa_val::temp(now_var));
+}
+
+void ExpAST::output_binary(int i, Ost& outstr, std::string prefix) {
+	auto op = nodes[i].op;
+	if(is_logic_op(op)) {
+		// the value is only needed here, so the branches store it
 		int cur_if_cnt = if_cnt;
 		if_cnt++;
-		outstr << prefix << "br " << lhs << ", %then_short" << cur_if_cnt
-			   << ", %else_short" << cur_if_cnt << "\n";
-		if(binary_op.value()->op == OP_LOR) {
-			enter_koopa_block("%then_short" + std::to_string(cur_if_cnt), outstr, prefix);
-			outstr << prefix << "store 1, " << SHORT_TMP_VAR_NAME << "\n";
-			// outstr << prefix << "%" << now_var << " = or 0, 1\n";
-			outstr << prefix << "jump %end_short" << cur_if_cnt << "\n";
-			outstr.mute();
-			exit_koopa_block(outstr, prefix);
-			enter_koopa_block("%else_short" + std::to_string(cur_if_cnt), outstr, prefix);
-		} else {
-			enter_koopa_block("%else_short" + std::to_string(cur_if_cnt), outstr, prefix);
-			outstr << prefix << "store 0, " << SHORT_TMP_VAR_NAME << "\n";
-			outstr << prefix << "jump %end_short" << cur_if_cnt << "\n";
+		std::string then_label = "%then_short" + std::to_string(cur_if_cnt);
+		std::string else_label = "%else_short" + std::to_string(cur_if_cnt);
+		std::string end_label = "%end_short" + std::to_string(cur_if_cnt);
+		output_cond_node(i, outstr, prefix, then_label, else_label);
+		for(auto [label, val] : {std::pair{then_label, 1}, std::pair{else_label, 0}}) {
+			enter_koopa_block(label, outstr, prefix);
+			outstr << prefix << "store " << val << ", " << SHORT_TMP_VAR_NAME << "\n";
+			outstr << prefix << "jump " << end_label << "\n";
 			outstr.mute();
 			exit_koopa_block(outstr, prefix);
-			enter_koopa_block("%then_short" + std::to_string(cur_if_cnt), outstr, prefix);
 		}
-
-		nxt_level->output(outstr, prefix);
-		Koopa_val rhs = stmt_val.top();
-		stmt_val.pop();
-		rhs.prepare(outstr, prefix);
+		enter_koopa_block(end_label, outstr, prefix);
 		int now_var = unnamed_var_cnt;
 		unnamed_var_cnt++;
-		outstr << prefix << "%" << now_var << " = ne 0, " << rhs << "\n";
-		outstr << prefix << "store %" << now_var << ", " << SHORT_TMP_VAR_NAME << "\n";
-		// outstr << "%" << now_var << " = or 0, " << rhs << "\n";
-		outstr << prefix << "jump %end_short" << cur_if_cnt << "\n";
-		outstr.mute();
-		exit_koopa_block(outstr, prefix);
-		enter_koopa_block("%end_short" + std::to_string(cur_if_cnt), outstr, prefix);
-		now_var = unnamed_var_cnt;
-		unnamed_var_cnt++;
 		outstr << prefix << "%" << now_var << " = load " << SHORT_TMP_VAR_NAME << "\n";
-		stmt_val.push(new Koopa_val_temp_symbol(now_var));
+		stmt_val.push(Koopa_val::temp(now_var));
 		return;
 	}
-	now_level.value()->output(outstr, prefix);
+	output_node(lhs_of(i), outstr, prefix);
 	Koopa_val lhs = stmt_val.top();
 	stmt_val.pop();
-	nxt_level->output(outstr, prefix);
+	output_node(i - 1, outstr, prefix);
 	Koopa_val rhs = stmt_val.top();
 	stmt_val.pop();
+	if(auto simple = Simplify::binary(op, lhs, rhs)) {
+		stmt_val.push(*simple);
+		return;
+	}
 	lhs.prepare(outstr, prefix);
 	rhs.prepare(outstr, prefix);
-	// if(binary_op.value()->is_logic_op()) {
-	// 	int now_var = unnamed_var_cnt;
-	// 	unnamed_var_cnt++;
-	// 	outstr << prefix << "%" << now_var << " = ne 0, " << lhs;
-	// 	lhs = new Koopa_val_temp_symbol(now_var);
-	// 	now_var = unnamed_var_cnt;
-	// 	unnamed_var_cnt++;
-	// 	outstr << prefix << "%" << now_var << " = ne 0, " << rhs;
-	// 	rhs = new Koopa_val_temp_symbol(now_var);
-	// }
 	int now_var = unnamed_var_cnt;
 	unnamed_var_cnt++;
-	outstr << prefix << "%" << now_var << " = ";
-	binary_op.value()->output(outstr, "");
-	outstr << lhs << ", " << rhs << '\n';
-	stmt_val.push(new Koopa_val_temp_symbol(now_var));
+	outstr << prefix << "%" << now_var << " = " << binary_inst(op) << lhs << ", " << rhs << '\n';
+	stmt_val.push(Koopa_val::temp(now_var));
 }
 
-template<typename T, typename U>
-int BinaryExpAST_Base<T, U>::calc() {
-	if(binary_op.has_value()) {
-		return binary_op.value()->calc(now_level.value()->calc(), nxt_level->calc());
-	} else {
-		return nxt_level->calc();
+void ExpAST::output_cond_node(int i, Ost& outstr, std::string prefix, const std::string& true_label, const std::string& false_label) {
+	auto& node = nodes[i];
+	switch(node.typ) {
+	case EXP_NUMBER:
+		outstr << prefix << "jump " << (node.val ? true_label : false_label) << "\n";
+		outstr.mute();
+		exit_koopa_block(outstr, prefix);
+		return;
+	case EXP_UNARY:
+		// negating keeps whether it is zero
+		if(node.op == OP_LNOT) {
+			return output_cond_node(i - 1, outstr, prefix, false_label, true_label);
+		}
+		return output_cond_node(i - 1, outstr, prefix, true_label, false_label);
+	case EXP_BINARY:
+		if(is_logic_op(node.op)) {
+			// the left operand alone may decide, otherwise the right one does
+			int cur_if_cnt = if_cnt;
+			if_cnt++;
+			std::string rhs_label = "%rhs_short" + std::to_string(cur_if_cnt);
+			if(node.op == OP_LAND) {
+				output_cond_node(lhs_of(i), outstr, prefix, rhs_label, false_label);
+			} else {
+				output_cond_node(lhs_of(i), outstr, prefix, true_label, rhs_label);
+			}
+			enter_koopa_block(rhs_label, outstr, prefix);
+			return output_cond_node(i - 1, outstr, prefix, true_label, false_label);
+		}
+		break;
+	default:;
 	}
+	output_node(i, outstr, prefix);
+	branch_on_value(outstr, prefix, true_label, false_label);
 }
 
 void DeclAST::output(Ost& outstr, std::string prefix) {
@@ -874,41 +1606,37 @@ void ConstDefAST::output_base(Ost& outstr, std::string prefix, bool is_global) {
 	prepare_dim();
 	if(dimension.empty()) {
 		auto& exp = std::get<0>(val->exp);
-		symbol_table.insert({ident, new Koopa_val_im(exp->calc())});
+		symbol_table.insert({ident, Koopa_val::im(exp->calc())});
 	} else {
 		if(!val->filled_zero) {
 			fill_zero_base(val.get(), dimension);
 		}
-		auto koopa_val = new Koopa_val_named_symbol();
-		// no set dimension
-		koopa_val->set_id(ident);
-		koopa_val->set_ptr(false);
-		koopa_val->set_dep(dimension.size());
-		outstr << prefix
-			   << (is_global ? "global " : "")
-			   << "@" << koopa_val->get_id() << " = alloc ";
+		auto info = new_symbol_info();
+		info->set_id(ident.str());
+		info->max_dep = dimension.size();
+		auto const_array = std::make_shared<Const_array>();
+		const_array->dims.assign(dimension.begin(), dimension.end());
+		flatten_const_initval(val.get(), dimension, const_array->data);
+		info->const_array = const_array;
+		// A const array never changes, so a local one is emitted once as a global
+		// instead of being rebuilt on every call.
+		Ost& global_outstr = is_global ? outstr : hoisted_globals;
+		global_outstr << "global @" << info->id << " = alloc ";
 		for(int i = dimension.size(); i-- > 0;) {
-			outstr << "[";
+			global_outstr << "[";
 		}
-		outstr << "i32";
+		global_outstr << "i32";
 		for(auto i = dimension.rbegin(); i != dimension.rend(); i++) {
-			outstr << ", " << *i << "]";
+			global_outstr << ", " << *i << "]";
 		}
-		if(is_global) {
-			outstr << ", ";
-			val->output_global(outstr, "");
-			outstr << "\n";
-		} else {
-			outstr << "\n";
-			assign_initval_to(val, koopa_val, outstr, prefix);
-			// outstr << prefix << "store ";
-			// val->output(outstr, "");
-			// outstr << ", @" << koopa_val->get_id() << "\n";
-		}
-		symbol_table.insert({ident, koopa_val});
-		// symbol_table.insert({ident, new Koopa_val_im(exp->calc())});
-	}
-	// symbol_table[ident] = new Koopa_val_im(std::get<int>(val->val.value()));
+		global_outstr << ", ";
+		val->output_global(global_outstr, "");
+		global_outstr << "\n";
+		readonly_globals.insert(info->id);
+		symbol_table.insert({ident, Koopa_val::named(info)});
+		// symbol_table.insert({ident, Koopa_val::im(exp->calc())});
+	}
+	// symbol_table[ident] = Koopa_val::im(std::get<int>(val->val.value()));
 	// symbol_const.insert({ident, std::get<int>(val->val.value())});
 	// symbol_const[ident] = std::get<int>(val->val.value());
 }
@@ -980,21 +1708,66 @@ void InitValAST::output(Ost& outstr, std::string prefix) {
 
 void LValAST::output(Ost& outstr, std::string prefix) {
 	// no prepare_dim
-	if(!symbol_table.contains(ident)) {
+	auto sym = symbol_table.find(ident);
+	if(!sym) {
 		std::cerr << "What is " << ident << "???\n";
 		throw 114514;
 	}
-	if(symbol_table[ident].val_type() == KOOPA_VALUE_TYPE_IMMEDIATE) {
-		stmt_val.push(symbol_table[ident]);
+	if(sym->val_type() == KOOPA_VALUE_TYPE_IMMEDIATE) {
+		stmt_val.push(*sym);
+	} else if(sym->get_const_array() && is_const_exp()) {
+		stmt_val.push(Koopa_val::im(calc()));
 	} else {
-		auto koopa_val = ((Koopa_val_named_symbol*)(symbol_table[ident].get_ptr()))->copy();
-		koopa_val->set_dim(*dim_list);
-		stmt_val.push(Koopa_val(koopa_val));
+		stmt_val.push(*sym);
+		stmt_val.top().set_dim(*dim_list);
+	}
+}
+
+int LValAST::calc() {
+	auto sym = symbol_table.find(ident);
+	if(!sym) {
+		std::cerr << "not find " << ident << " in symbol_table\n";
+		throw 114514;
+	}
+	auto const_array = sym->get_const_array();
+	if(!const_array) {
+		return sym->get_im_val();
+	}
+	std::vector<int> index;
+	for(auto& i : *dim_list) {
+		index.push_back(i->calc());
+	}
+	if(!const_array->contains(index)) {
+		std::cerr << "index out of range or incomplete: " << ident << "\n";
+		throw 114514;
 	}
+	return const_array->get(index);
+}
+
+bool LValAST::is_const_exp() {
+	auto sym = symbol_table.find(ident);
+	if(!sym) {
+		return false;
+	}
+	if(sym->val_type() == KOOPA_VALUE_TYPE_IMMEDIATE) {
+		return true;
+	}
+	auto const_array = sym->get_const_array();
+	if(!const_array || dim_list->size() != const_array->dims.size()) {
+		return false;
+	}
+	std::vector<int> index;
+	for(auto& i : *dim_list) {
+		if(!i->is_const_exp()) {
+			return false;
+		}
+		index.push_back(i->calc());
+	}
+	return const_array->contains(index);
 }
 
 void ConstExpAST::output(Ost& outstr, std::string prefix) {
-	stmt_val.push(Koopa_val(new Koopa_val_im(calc())));
+	stmt_val.push(Koopa_val::im(calc()));
 }
 
 void VarDeclAST::output(Ost& outstr, std::string prefix) {
@@ -1013,13 +1786,13 @@ void VarDeclAST::output_global(Ost& outstr, std::string prefix) const {
 
 void VarDefAST::output_base(Ost& outstr, std::string prefix, bool is_global) {
 	prepare_dim();
-	auto reg_var = new Koopa_val_named_symbol;
-	reg_var->set_id(ident);
-	reg_var->set_ptr(false);
-	reg_var->set_dep(dimension.size());
+	auto info = new_symbol_info();
+	info->set_id(ident.str());
+	info->max_dep = dimension.size();
+	auto reg_var = Koopa_val::named(info);
 	outstr << prefix
 		   << (is_global ? "global " : "")
-		   << "@" << reg_var->get_id() << " = alloc ";
+		   << "@" << info->id << " = alloc ";
 	for(int i = dimension.size(); i-- > 0;) {
 		outstr << "[";
 	}
@@ -1037,11 +1810,12 @@ void VarDefAST::output_base(Ost& outstr, std::string prefix, bool is_global) {
 			outstr << "\n";
 		} else {
 			outstr << "\n";
-			assign_initval_to(val.value(), reg_var, outstr, prefix);
+			auto filled = Array_Init::output_bulk_init(reg_var, val.value().get(), dimension, outstr, prefix);
+			assign_initval_to(val.value(), reg_var, outstr, prefix, filled);
 			// Koopa_val last_val = stmt_val.top();
 			// stmt_val.pop();
 			// last_val.prepare(outstr, prefix);
-			// reg_var->store(last_val.get_str(), outstr, prefix);
+			// reg_var.store(last_val, outstr, prefix);
 		}
 	} else {
 		if(is_global) {
@@ -1049,7 +1823,7 @@ void VarDefAST::output_base(Ost& outstr, std::string prefix, bool is_global) {
 		}
 		outstr << "\n";
 	}
-	symbol_table.insert({ident, Koopa_val(reg_var)});
+	symbol_table.insert({ident, reg_var});
 }
 void VarDefAST::output(Ost& outstr, std::string prefix) {
 	output_base(outstr, prefix, false);
@@ -1068,7 +1842,7 @@ void LValAssignAST::output(Ost& outstr, std::string prefix) {
 	rhs = stmt_val.top();
 	stmt_val.pop();
 	rhs.prepare(outstr, prefix);
-	lhs.store(rhs.get_str(), outstr, prefix);
+	lhs.store(rhs, outstr, prefix);
 	// outstr << prefix << "store " << rhs << ", @" << lhs.get_named_name() << '\n';
 }
 
@@ -1078,6 +1852,9 @@ void ReturnAST::output(Ost& outstr, std::string prefix) {
 		Koopa_val val = stmt_val.top();
 		stmt_val.pop();
 		val.prepare(outstr, prefix);
+		if(Memoize::cur_memo.has_value()) {
+			Memoize::output_save(outstr, prefix, val.get_str());
+		}
 		outstr << prefix << "ret " << val << '\n';
 	} else {
 		outstr << prefix << "ret\n";
@@ -1108,11 +1885,7 @@ std::string IfAST::get_end_str() const {
 }
 
 void IfAST::output(Ost& outstr, std::string prefix) {
-	cond->output(outstr, prefix);
-	auto cond_val = stmt_val.top();
-	stmt_val.pop();
-	cond_val.prepare(outstr, prefix);
-	outstr << prefix << "br " << cond_val << ", " << get_then_str() << ", " << get_else_str() << "\n";
+	cond->output_cond(outstr, prefix, get_then_str(), get_else_str());
 	enter_koopa_block(get_then_str(), outstr, prefix);
 	if_stmt->output(outstr, prefix);
 	if(!outstr.muted) {
@@ -1140,17 +1913,7 @@ void WhileAST::output(Ost& outstr, std::string prefix) {
 	outstr.mute();
 	exit_koopa_block(outstr, prefix);
 	enter_koopa_block("%loop_entry" + std::to_string(cur_loop_cnt), outstr, prefix);
-	cond->output(outstr, prefix);
-	auto cond = stmt_val.top();
-	stmt_val.pop();
-	cond.prepare(outstr, prefix);
-	outstr << prefix
-		   << "br " << cond
-		   << ", %loop_body" << cur_loop_cnt
-		   << ", %loop_end" << cur_loop_cnt
-		   << "\n";
-	outstr.mute();
-	exit_koopa_block(outstr, prefix);
+	cond->output_cond(outstr, prefix, "%loop_body" + std::to_string(cur_loop_cnt), "%loop_end" + std::to_string(cur_loop_cnt));
 	enter_koopa_block("%loop_body" + std::to_string(cur_loop_cnt), outstr, prefix);
 	stmt->output(outstr, prefix);
 	outstr << prefix << "jump %loop_entry" << cur_loop_cnt << "\n";
@@ -1203,11 +1966,12 @@ void FuncDefParamAST::output(Ost& outstr, std::string prefix) {
 
 void FuncDefParamAST::output_save(Ost& outstr, std::string prefix) {
 	prepare_dim();
-	auto val = new Koopa_val_named_symbol();
-	val->set_id(id);
-	val->set_ptr(is_ptr);
-	val->set_dep(dimension.size());
-	outstr << prefix << "@" << val->get_id() << " = alloc "
+	auto info = new_symbol_info();
+	info->set_id(id.str());
+	info->is_ptr = is_ptr;
+	info->max_dep = dimension.size();
+	auto val = Koopa_val::named(info);
+	outstr << prefix << "@" << info->id << " = alloc "
 		   << (is_ptr ? "*" : "");
 	for(int i = dimension.size(); i-- > 0;) {
 		outstr << "[";
@@ -1217,7 +1981,7 @@ void FuncDefParamAST::output_save(Ost& outstr, std::string prefix) {
 		outstr << ", " << i << "]";
 	}
 	outstr << "\n";
-	val->store(std::string("@") + id + std::string("_param"),
+	val.store("@" + id.str() + "_param",
 			   outstr,
 			   prefix);
 	// << prefix << "store @" << i.second << "_param, @" << val->get_id() << "\n";
@@ -1238,8 +2002,8 @@ void FuncCallAST::output(Ost& outstr, std::string prefix) {
 	params->output(outstr, prefix);
 	int param_cnt = params->get_param_cnt();
 	int now_var = -1;
-	auto func_in_koopa = symbol_table[func];
-	std::list<Koopa_val> args;
+	auto& func_in_koopa = symbol_table[func];
+	Small_vector<Koopa_val, 8> args;
 	for(int i = 0; i < param_cnt; i++) {
 		args.push_back(stmt_val.top());
 		args.back().prepare(outstr, prefix);
@@ -1252,7 +2016,7 @@ void FuncCallAST::output(Ost& outstr, std::string prefix) {
 		unnamed_var_cnt++;
 		outstr << prefix << "%" << now_var << " = ";
 	}
-	outstr << "call " << func_in_koopa.get_str() << "(";
+	outstr << "call " << func_in_koopa << "(";
 	bool first_param = true;
 	for(auto& i : args) {
 		if(first_param) {
@@ -1264,9 +2028,14 @@ void FuncCallAST::output(Ost& outstr, std::string prefix) {
 	}
 	outstr << ")\n";
 	if(!func_in_koopa.is_func_void()) {
-		stmt_val.push(Koopa_val(new Koopa_val_temp_symbol(now_var)));
+		stmt_val.push(Koopa_val::temp(now_var));
 	}
 }
 
+int FuncCallAST::calc() {
+	std::cerr << "function call " << func << " in constant expression\n";
+	throw 114514;
+}
+
 }   // namespace Ast_Defs
 }   // namespace Ast_Base
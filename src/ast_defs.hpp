@@ -1,4 +1,6 @@
 #pragma once
+#include <cstddef>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <map>
@@ -7,8 +9,10 @@
 #include <sstream>
 #include <stack>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <variant>
+#include <vector>
 
 namespace Ast_Base {
 
@@ -31,7 +35,72 @@ public:
 	void mute() { muted = true; }
 	void unmute() { muted = false; }
 };
-constexpr int BINARY_EXP_MAX_LEVEL = 5;
+
+// Names (without '@') of globals that are never written, emitted into .rodata by the backend.
+extern std::unordered_set<std::string> readonly_globals;
+
+// Bump allocator for everything the parser builds. Nothing is freed before
+// release(), which frees all of it at once, or rewind(), which frees what was
+// allocated since a mark.
+class Arena {
+public:
+	static constexpr size_t BLOCK_SIZE = 1 << 16;
+	class Mark {
+	public:
+		size_t blocks;
+		char *cur;
+		size_t left;
+	};
+	void *allocate(size_t size, size_t align = alignof(std::max_align_t));
+	Mark mark() const { return {blocks.size(), cur, left}; }
+	void rewind(Mark const &to);
+	void release();
+	~Arena() { release(); }
+
+private:
+	std::vector<char *> blocks;
+	char *cur = nullptr;
+	size_t left = 0;
+};
+
+extern Arena ast_arena;
+
+template<typename T>
+class Arena_allocator {
+public:
+	using value_type = T;
+	Arena_allocator() = default;
+	template<typename U>
+	Arena_allocator(Arena_allocator<U> const &) {}
+	T *allocate(size_t n) { return (T *)ast_arena.allocate(n * sizeof(T), alignof(T)); }
+	void deallocate(T *, size_t) {}
+	template<typename U>
+	bool operator==(Arena_allocator<U> const &) const { return true; }
+};
+
+// Objects of these classes live in ast_arena, deleting them only runs the destructor.
+class Arena_object {
+public:
+	static void *operator new(size_t size) { return ast_arena.allocate(size); }
+	static void operator delete(void *) {}
+};
+
+template<typename T>
+class Ast_list : public std::list<T, Arena_allocator<T>>, public Arena_object {
+public:
+	using std::list<T, Arena_allocator<T>>::list;
+};
+
+// An identifier interned by the lexer, equal names have equal ids.
+class Ident {
+public:
+	int id;
+	const std::string &str() const;
+	bool operator==(Ident const &) const = default;
+};
+
+Ident intern(std::string_view name);
+std::ostream &operator<<(std::ostream &out, Ident ident);
 
 template<typename... Types>
 using VariantAstPtr = std::variant<std::unique_ptr<Types>...>;
@@ -55,19 +124,12 @@ enum Op_type {
 	OP_LNOT
 };
 
-class BaseAST {
+class BaseAST : public Arena_object {
 public:
 	virtual ~BaseAST() = default;
 	virtual void output(Ost &, std::string) = 0;
 };
 
-class OpAST : public BaseAST {
-public:
-	Op_type op;
-	OpAST(Op_type typ) { op = typ; }
-};
-
-class BinaryOpAST;
 class BlockAST;
 class BlockItemAST;
 class BreakAST;
@@ -89,38 +151,41 @@ class InitValAST;
 class LValAssignAST;
 class LValAST;
 class OptionalExpAST;
-class PrimaryExpAST;
 class ReturnAST;
 class StmtAST;
 class TypeAST;
-class UnaryExpAST;
-class UnaryOpAST;
 class VarDeclAST;
 class VarDefAST;
 class WhileAST;
 
-template<int>
-class BinaryExpAST;
-
 class Dimension_list {
 public:
 	std::list<int> dimension;
-	std::unique_ptr<std::list<std::unique_ptr<ExpAST>>> dim_list;
+	std::unique_ptr<Ast_list<std::unique_ptr<ExpAST>>> dim_list;
 	void prepare_dim();
 };
 
 
 class CompUnitAST : public BaseAST {
 public:
-	std::list<VariantAstPtr<FuncDefAST, DeclAST>> decls;
+	Ast_list<VariantAstPtr<FuncDefAST, DeclAST>> decls;
 	void output(Ost &outstr, std::string prefix) override;
+	// Pieces of output(), used when the unit is emitted one item at a time.
+	static void output_lib_decls(Ost &outstr);
+	static void enter_global_scope();
+	static void exit_global_scope();
+	static void output_item(VariantAstPtr<FuncDefAST, DeclAST> &item, Ost &outstr, std::string prefix);
 };
 
+// Called by the parser when the unit is made, then after each top-level
+// FuncDef/Decl is appended, if set.
+extern std::function<void(CompUnitAST &)> top_level_hook;
+
 class FuncDefAST : public BaseAST {
 public:
 	std::unique_ptr<TypeAST> func_typ;
 	std::optional<std::unique_ptr<FuncDefParamsAST>> params;
-	std::string ident;
+	Ident ident;
 	std::unique_ptr<BlockAST> block;
 	void output(Ost &outstr, std::string prefix) override;
 };
@@ -135,7 +200,7 @@ public:
 
 class BlockAST : public BaseAST {
 public:
-	std::list<std::unique_ptr<BlockItemAST>> items;
+	Ast_list<std::unique_ptr<BlockItemAST>> items;
 	void output_base(Ost &outstr, std::string prefix, bool update_symbol_table) const;
 	void output(Ost &outstr, std::string prefix) override;
 };
@@ -159,68 +224,49 @@ public:
 	void output(Ost &outstr, std::string prefix) override;
 };
 
-class ExpAST : public BaseAST {
-public:
-	std::unique_ptr<BinaryExpAST<BINARY_EXP_MAX_LEVEL>> binary_exp;
-	int calc();
-	void output(Ost &outstr, std::string prefix) override;
+enum Exp_node_type {
+	EXP_NUMBER,
+	EXP_LVAL,
+	EXP_CALL,
+	EXP_UNARY,
+	EXP_BINARY,
 };
 
-class UnaryExpAST : public BaseAST {
+class Exp_node {
 public:
-	std::optional<std::unique_ptr<UnaryOpAST>> unary_op;
-	VariantAstPtr<UnaryExpAST, PrimaryExpAST> unary_exp;
-	void output(Ost &outstr, std::string prefix) override;
-	int calc();
+	Exp_node_type typ;
+	Op_type op;   // EXP_UNARY and EXP_BINARY
+	int val;      // EXP_NUMBER
+	int begin;    // index of the first node of the subexpression ending here
+	std::unique_ptr<LValAST> lval;
+	std::unique_ptr<FuncCallAST> call;
 };
 
-class PrimaryExpAST : public BaseAST {
+// The nodes of an expression in postfix order, with precedence resolved by the
+// parser. The last node is the root. An operand ends right before its operator,
+// and the left operand of a binary one ends right before the right one begins.
+class ExpAST : public BaseAST {
 public:
-	std::variant<std::unique_ptr<ExpAST>, std::unique_ptr<LValAST>, int> inside_exp;
-	void output(Ost &outstr, std::string prefix) override;
+	std::vector<Exp_node, Arena_allocator<Exp_node>> nodes;
+	static ExpAST *number(int val);
+	static ExpAST *lval(LValAST *lval);
+	static ExpAST *call(FuncCallAST *call);
+	// These take the nodes of their operands, which are deleted.
+	static ExpAST *unary(Op_type op, ExpAST *exp);
+	static ExpAST *binary(Op_type op, ExpAST *lhs, ExpAST *rhs);
 	int calc();
-};
-
-class UnaryOpAST : public OpAST {
-public:
-	using OpAST::OpAST;
-	void output(Ost &outstr, std::string prefix) override;
-	int calc(int x);
-};
-
-class BinaryOpAST : public OpAST {
-public:
-	using OpAST::OpAST;
-	bool is_logic_op();
+	bool is_const_exp();
 	void output(Ost &outstr, std::string prefix) override;
-	int calc(int lhs, int rhs);
-};
+	void output_cond(Ost &outstr, std::string prefix, const std::string &true_label, const std::string &false_label);
 
-template<typename Now_Level_Type, typename Nxt_Level_Type>
-class BinaryExpAST_Base : public BaseAST {
-public:
-	std::optional<std::unique_ptr<Now_Level_Type>> now_level;
-	std::optional<std::unique_ptr<BinaryOpAST>> binary_op;
-	std::unique_ptr<Nxt_Level_Type> nxt_level;
-	void output(Ost &outstr, std::string prefix) override;
-	int calc();
+private:
+	int lhs_of(int i) const { return nodes[i - 1].begin - 1; }
+	void output_node(int i, Ost &outstr, std::string prefix);
+	void output_unary(int i, Ost &outstr, std::string prefix);
+	void output_binary(int i, Ost &outstr, std::string prefix);
+	void output_cond_node(int i, Ost &outstr, std::string prefix, const std::string &true_label, const std::string &false_label);
 };
 
-template<int level>
-class BinaryExpAST : public BinaryExpAST_Base<BinaryExpAST<level>, BinaryExpAST<level - 1>> {};
-
-template<>
-class BinaryExpAST<0> : public BinaryExpAST_Base<BinaryExpAST<0>, UnaryExpAST> {};
-
-// clang-format off
-using MulExpAST = BinaryExpAST<0>;
-using AddExpAST = BinaryExpAST<1>;	template class BinaryExpAST<1>;
-using RelExpAST = BinaryExpAST<2>;	template class BinaryExpAST<2>;
-using EqExpAST = BinaryExpAST<3>;	template class BinaryExpAST<3>;
-using LAndExpAST = BinaryExpAST<4>;	template class BinaryExpAST<4>;
-using LOrExpAST = BinaryExpAST<5>;	template class BinaryExpAST<5>;
-// clang-format on
-
 class DeclAST : public BaseAST {
 public:
 	VariantAstPtr<ConstDeclAST, VarDeclAST> decl;
@@ -231,14 +277,14 @@ public:
 class ConstDeclAST : public BaseAST {
 public:
 	std::unique_ptr<TypeAST> typ;
-	std::list<std::unique_ptr<ConstDefAST>> defs;
+	Ast_list<std::unique_ptr<ConstDefAST>> defs;
 	void output(Ost &outstr, std::string prefix) override;
 	void output_global(Ost &outstr, std::string prefix) const;
 };
 
 class ConstDefAST : public BaseAST, public Dimension_list {
 public:
-	std::string ident;
+	Ident ident;
 	std::unique_ptr<ConstInitValAST> val;
 	void output_base(Ost &outstr, std::string prefix, bool is_global);
 	void output(Ost &outstr, std::string prefix) override;
@@ -247,7 +293,7 @@ public:
 
 class ConstInitValAST : public BaseAST, public Dimension_list {
 public:
-	std::variant<std::unique_ptr<ConstExpAST>, std::list<std::unique_ptr<ConstInitValAST>>> exp;
+	std::variant<std::unique_ptr<ConstExpAST>, Ast_list<std::unique_ptr<ConstInitValAST>>> exp;
 	bool filled_zero = false;
 	bool is_zero;   // must be list
 	void output(Ost &outstr, std::string prefix) override;
@@ -261,14 +307,16 @@ public:
 
 class LValAST : public BaseAST, public Dimension_list {
 public:
-	std::string ident;
+	Ident ident;
 	void output(Ost &outstr, std::string prefix) override;
+	int calc();
+	bool is_const_exp();
 };
 
 class VarDeclAST : public BaseAST {
 public:
 	std::unique_ptr<TypeAST> typ;
-	std::list<std::unique_ptr<VarDefAST>> defs;
+	Ast_list<std::unique_ptr<VarDefAST>> defs;
 	void output(Ost &outstr, std::string prefix) override;
 	void output_global(Ost &outstr, std::string prefix) const;
 };
@@ -276,7 +324,7 @@ public:
 class VarDefAST : public BaseAST, public Dimension_list {
 public:
 	std::unique_ptr<TypeAST> typ;
-	std::string ident;
+	Ident ident;
 	std::optional<std::unique_ptr<InitValAST>> val;
 	void output_base(Ost &outstr, std::string prefix, bool is_global);
 	void output(Ost &outstr, std::string prefix) override;
@@ -285,7 +333,7 @@ public:
 
 class InitValAST : public BaseAST, public Dimension_list {
 public:
-	std::variant<std::unique_ptr<ExpAST>, std::list<std::unique_ptr<InitValAST>>> exp;
+	std::variant<std::unique_ptr<ExpAST>, Ast_list<std::unique_ptr<InitValAST>>> exp;
 	bool filled_zero = false;
 	bool is_zero;   // must be list
 	void output(Ost &outstr, std::string prefix) override;
@@ -338,7 +386,7 @@ public:
 
 class FuncDefParamsAST : public BaseAST {
 public:
-	std::list<std::unique_ptr<FuncDefParamAST>> params;
+	Ast_list<std::unique_ptr<FuncDefParamAST>> params;
 	void output(Ost &outstr, std::string prefix) override;
 	void output_save(Ost &outstr, std::string prefix) const;
 };
@@ -346,22 +394,24 @@ public:
 class FuncDefParamAST : public BaseAST, public Dimension_list {
 public:
 	std::unique_ptr<TypeAST> typ;
-	std::string id;
+	Ident id;
 	bool is_ptr;
 	void output(Ost &outstr, std::string prefix) override;
 	void output_save(Ost &outstr, std::string prefix);
 };
 
+// Never a constant.
 class FuncCallAST : public BaseAST {
 public:
-	std::string func;
+	Ident func;
 	std::unique_ptr<FuncCallParamsAST> params;
 	void output(Ost &outstr, std::string prefix) override;
+	int calc();
 };
 
 class FuncCallParamsAST : public BaseAST {
 public:
-	std::list<std::unique_ptr<ExpAST>> params;
+	Ast_list<std::unique_ptr<ExpAST>> params;
 	int get_param_cnt() const;
 	void output(Ost &outstr, std::string prefix) override;
 };
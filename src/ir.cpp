@@ -1,16 +1,37 @@
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <stack>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "ir.hpp"
 #include "koopa.h"
 
+namespace Global_State {
+
+int offset_cnt;
+int basic_blk_cnt;
+std::stack<int> function_stack_mem;
+std::stack<bool> save_ra;
+std::stack<int> reg_save_offset;   // ra, then s0 when the frame uses a base register
+std::stack<int> frame_base;        // s0 = sp + frame_base, 0 if s0 is not used
+std::stack<int> stack_param_cnt;   // arguments our caller passed on the stack
+
+}   // namespace Global_State
+
 namespace Asm_Val_Defs {
 
+bool is_imm12(int x) {
+	return x >= -2048 && x <= 2047;
+}
+
 enum Asm_val_type {
 	ASM_VAL_TYPE_IMMEDIATE,
 	ASM_VAL_TYPE_STACK,
@@ -19,8 +40,11 @@ enum Asm_val_type {
 };
 
 void access_sp(std::string reg, int offset, bool is_save_to_sp, Outp &outstr) {
-	if(offset >= -2048 && offset <= 2047) {
+	int base = Global_State::frame_base.empty() ? 0 : Global_State::frame_base.top();
+	if(is_imm12(offset)) {
 		outstr << (is_save_to_sp ? "sw " : "lw ") << reg << ", " << offset << "(sp)\n";
+	} else if(base != 0 && is_imm12(offset - base)) {
+		outstr << (is_save_to_sp ? "sw " : "lw ") << reg << ", " << offset - base << "(s0)\n";
 	} else {
 		assert(reg != "t2");
 		std::string tmp_reg = "t2";
@@ -48,6 +72,9 @@ public:
 	virtual void assign_ptr_from_reg(std::string reg, Outp &outstr) const { access_ptr_via_reg(reg, false, outstr); }
 	virtual void assign_from_reg(std::string reg, Outp &outstr) const = 0;
 	virtual void assign_addr_from_reg(std::string reg, Outp &outstr) const { assert(0); }
+	virtual void assign_real_from_reg(std::string reg, Outp &outstr) const { assign_from_reg(reg, outstr); }
+	// the offset from sp of the object itself, if it lives in the frame
+	virtual std::optional<int> sp_offset() const { return std::nullopt; }
 };
 
 class Asm_val_im : public Asm_val {
@@ -68,6 +95,7 @@ private:
 
 public:
 	Asm_val_localvar(int input_offset) { offset = input_offset; }
+	std::optional<int> sp_offset() const override { return offset; }
 	void assign_from_reg(std::string reg, Outp &outstr) const override {
 		access_sp(reg, offset, true, outstr);
 	}
@@ -75,8 +103,15 @@ public:
 		access_sp(reg, offset, false, outstr);
 	}
 	void load_addr_to_reg(std::string reg, Outp &outstr) const override {
-		outstr << "li t0, " << offset << "\n"
-			   << "add " << reg << ", sp, t0\n";
+		int base = Global_State::frame_base.empty() ? 0 : Global_State::frame_base.top();
+		if(is_imm12(offset)) {
+			outstr << "addi " << reg << ", sp, " << offset << "\n";
+		} else if(base != 0 && is_imm12(offset - base)) {
+			outstr << "addi " << reg << ", s0, " << offset - base << "\n";
+		} else {
+			outstr << "li " << reg << ", " << offset << "\n"
+				   << "add " << reg << ", sp, " << reg << "\n";
+		}
 	}
 };
 
@@ -139,23 +174,74 @@ public:
 	void assign_addr_from_reg(std::string reg, Outp &outstr) const override {
 		access_sp(reg, offset, true, outstr);
 	}
+	void assign_real_from_reg(std::string reg, Outp &outstr) const override {
+		assign_addr_from_reg(reg, outstr);
+	}
 };
 }   // namespace Asm_Val_Defs
 
 using namespace Asm_Val_Defs;
 
-namespace Global_State {
-
-int offset_cnt;
-int basic_blk_cnt;
-std::stack<int> function_stack_mem;
-std::stack<bool> save_ra;
-
-}   // namespace Global_State
-
 std::unordered_map<void *, std::shared_ptr<Asm_val>> valmp;
 std::unordered_map<koopa_raw_basic_block_t, std::string> blk_id_mp;
 std::unordered_set<void *> visited;
+std::unordered_set<std::string> rodata_symbols;
+std::unordered_set<std::string> emitted_globals;   // kept across programs of one output
+
+namespace Asm_Val_Defs {
+
+// A pointer a constant offset from another value that is only used to address
+// memory. It gets no slot: loads and stores through it take the offset as
+// their immediate, right from a frame object or from the base pointer.
+class Asm_val_offset_ptr : public Asm_val {
+private:
+	koopa_raw_value_t base;
+	bool base_is_object;   // the base is the object (getelemptr), not a pointer to it (getptr)
+	int offset;
+
+	void load_base_to_reg(std::string reg, Outp &outstr) const {
+		if(base_is_object) {
+			valmp[(void *)base]->load_addr_to_reg(reg, outstr);
+		} else {
+			valmp[(void *)base]->load_real_to_reg(reg, outstr);
+		}
+	}
+	void access(std::string reg, bool is_load, Outp &outstr) const {
+		auto frame_offset = base_is_object ? valmp[(void *)base]->sp_offset() : std::nullopt;
+		if(frame_offset.has_value()) {
+			access_sp(reg, *frame_offset + offset, !is_load, outstr);
+			return;
+		}
+		std::string tmp_reg = (reg == "t0" ? "t1" : "t0");
+		load_base_to_reg(tmp_reg, outstr);
+		outstr << (is_load ? "lw " : "sw ") << reg << ", " << offset << "(" << tmp_reg << ")\n";
+	}
+
+public:
+	Asm_val_offset_ptr(koopa_raw_value_t input_base, bool input_base_is_object, int input_offset) {
+		base = input_base;
+		base_is_object = input_base_is_object;
+		offset = input_offset;
+	}
+	void load_to_reg(std::string reg, Outp &outstr) const override { access(reg, true, outstr); }
+	void assign_from_reg(std::string reg, Outp &outstr) const override { access(reg, false, outstr); }
+	void load_addr_to_reg(std::string reg, Outp &outstr) const override {
+		load_base_to_reg(reg, outstr);
+		if(offset != 0) outstr << "addi " << reg << ", " << reg << ", " << offset << "\n";
+	}
+	void load_real_to_reg(std::string reg, Outp &outstr) const override { load_addr_to_reg(reg, outstr); }
+};
+
+}   // namespace Asm_Val_Defs
+
+std::unordered_map<koopa_raw_value_t, std::shared_ptr<Asm_val>> offset_ptrs;   // of the function being emitted
+
+void emit_call(const koopa_raw_value_t &val, bool is_tail, Outp &outstr);
+void emit_epilogue(Outp &outstr);
+
+void set_rodata_symbols(std::unordered_set<std::string> syms) {
+	rodata_symbols = std::move(syms);
+}
 
 // return mem(byte).
 
@@ -192,39 +278,53 @@ int get_array_len(const koopa_raw_value_t arr) {
 	}
 }
 
-int get_function_stack_mem(const koopa_raw_value_t &val) {
+// Scalars and spill slots are laid out first (big == false) so that they stay
+// within a 12-bit offset of sp, arrays (big == true) go behind them.
+int get_function_stack_mem(const koopa_raw_value_t &val, bool big) {
 	if(val->ty->tag == KOOPA_RTT_UNIT) {
 		return 0;
 	}
-	if(val->kind.tag == KOOPA_RVT_GET_ELEM_PTR || val->kind.tag == KOOPA_RVT_GET_PTR) {
-		valmp[(void *)val] = std::make_shared<Asm_val_localptr>(Global_State::offset_cnt);
-	} else {
-		valmp[(void *)val] = std::make_shared<Asm_val_localvar>(Global_State::offset_cnt);
-	}
 	int siz = 4;
 	if(val->kind.tag == KOOPA_RVT_ALLOC) {
 		siz = get_array_size(val);
 	}
+	if((siz > 4) != big) {
+		return 0;
+	}
+	if(auto it = offset_ptrs.find(val); it != offset_ptrs.end()) {
+		valmp[(void *)val] = it->second;
+		return 0;
+	}
+	// a pointer parameter holds its pointer like the instructions making one
+	bool ptr_param = val->kind.tag == KOOPA_RVT_BLOCK_ARG_REF && val->ty->tag == KOOPA_RTT_POINTER;
+	if(val->kind.tag == KOOPA_RVT_GET_ELEM_PTR || val->kind.tag == KOOPA_RVT_GET_PTR || ptr_param) {
+		valmp[(void *)val] = std::make_shared<Asm_val_localptr>(Global_State::offset_cnt);
+	} else {
+		valmp[(void *)val] = std::make_shared<Asm_val_localvar>(Global_State::offset_cnt);
+	}
 	Global_State::offset_cnt += siz;
 	return siz;
 }
 
-int get_function_stack_mem(const koopa_raw_basic_block_t &blk) {
+int get_function_stack_mem(const koopa_raw_basic_block_t &blk, bool big) {
 	int sum_size = 0;
+	for(size_t i = 0; i < blk->params.len; i++) {
+		sum_size += get_function_stack_mem((koopa_raw_value_t)blk->params.buffer[i], big);
+	}
 	for(size_t i = 0; i < blk->insts.len; i++) {
 		assert(blk->insts.kind == KOOPA_RSIK_VALUE);
 		koopa_raw_value_t val = (koopa_raw_value_t)blk->insts.buffer[i];
-		sum_size += get_function_stack_mem(val);
+		sum_size += get_function_stack_mem(val, big);
 	}
 	return sum_size;
 }
 
-int get_function_stack_mem(const koopa_raw_function_t &func) {
+int get_function_stack_mem(const koopa_raw_function_t &func, bool big) {
 	int sum_size = 0;
 	for(size_t i = 0; i < func->bbs.len; i++) {
 		assert(func->bbs.kind == KOOPA_RSIK_BASIC_BLOCK);
 		koopa_raw_basic_block_t blk = (koopa_raw_basic_block_t)func->bbs.buffer[i];
-		sum_size += get_function_stack_mem(blk);
+		sum_size += get_function_stack_mem(blk, big);
 	}
 	return sum_size;
 }
@@ -256,17 +356,97 @@ int get_function_max_call_param(const koopa_raw_function_t &func) {
 	return ret;
 }
 
+// Constant-index getelemptr/getptr whose results are only loaded from, stored
+// to or indexed further become offsets from the first pointer of their chain
+// that is kept in a slot, or from the object it starts at.
+void find_offset_ptrs(const koopa_raw_function_t &func) {
+	offset_ptrs.clear();
+	std::vector<koopa_raw_value_t> geps;
+	std::unordered_set<koopa_raw_value_t> escaped;
+	auto escape_all = [&](const koopa_raw_slice_t &vals) {
+		for(size_t i = 0; i < vals.len; i++) {
+			escaped.insert((koopa_raw_value_t)vals.buffer[i]);
+		}
+	};
+	for(size_t i = 0; i < func->bbs.len; i++) {
+		auto blk = (koopa_raw_basic_block_t)func->bbs.buffer[i];
+		for(size_t j = 0; j < blk->insts.len; j++) {
+			auto val = (koopa_raw_value_t)blk->insts.buffer[j];
+			const auto &kind = val->kind;
+			switch(kind.tag) {
+			case KOOPA_RVT_GET_ELEM_PTR:
+			case KOOPA_RVT_GET_PTR:
+				if(kind.data.get_elem_ptr.index->kind.tag == KOOPA_RVT_INTEGER) geps.push_back(val);
+				break;
+			case KOOPA_RVT_STORE:
+				escaped.insert(kind.data.store.value);
+				break;
+			case KOOPA_RVT_CALL:
+				escape_all(kind.data.call.args);
+				break;
+			case KOOPA_RVT_BRANCH:
+				escape_all(kind.data.branch.true_args);
+				escape_all(kind.data.branch.false_args);
+				break;
+			case KOOPA_RVT_JUMP:
+				escape_all(kind.data.jump.args);
+				break;
+			case KOOPA_RVT_RETURN:
+				if(kind.data.ret.value != nullptr) escaped.insert(kind.data.ret.value);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	// a chain is resolved from its source, which comes first; were it not, the
+	// source would merely be a base of its own
+	class Chain {
+	public:
+		koopa_raw_value_t base;
+		bool base_is_object;
+		int64_t offset;
+	};
+	std::unordered_map<koopa_raw_value_t, Chain> chains;
+	for(auto val : geps) {
+		if(escaped.contains(val)) continue;
+		const auto &gep = val->kind.data.get_elem_ptr;
+		koopa_raw_type_t pointee = gep.src->ty->data.pointer.base;
+		int size = get_array_size(val->kind.tag == KOOPA_RVT_GET_PTR ? pointee : pointee->data.array.base);
+		Chain chain{gep.src, val->kind.tag == KOOPA_RVT_GET_ELEM_PTR, 0};
+		if(auto it = chains.find(gep.src); it != chains.end()) chain = it->second;
+		chain.offset += (int64_t)(int32_t)gep.index->kind.data.integer.value * size;
+		if(chain.offset < -2048 || chain.offset > 2047) continue;
+		chains[val] = chain;
+		offset_ptrs[val] = std::make_shared<Asm_val_offset_ptr>(chain.base, chain.base_is_object, (int)chain.offset);
+	}
+}
+
 int get_function_mem(const koopa_raw_function_t &func) {
+	find_offset_ptrs(func);
 	int max_call_param = get_function_max_call_param(func);
 	int param_mem = std::max(max_call_param - 8, 0) * 4;
 	Global_State::offset_cnt = param_mem;
-	int stack_mem = get_function_stack_mem(func);
+	Global_State::reg_save_offset.push(Global_State::offset_cnt);
+	Global_State::offset_cnt += 8;
+	get_function_stack_mem(func, false);
+	// register arguments get a slot, they may be read after a call
+	for(size_t i = 0; i < func->params.len && i < 8; i++) {
+		valmp[(void *)func->params.buffer[i]] = std::make_shared<Asm_val_localvar>(Global_State::offset_cnt);
+		Global_State::offset_cnt += 4;
+	}
+	get_function_stack_mem(func, true);
 	Global_State::save_ra.push(max_call_param != -1);
-	int sum_mem = param_mem + stack_mem + (max_call_param == -1 ? 0 : 4);
-	return int(std::ceil(sum_mem / 16.0)) * 16;
+	int mem = int(std::ceil(Global_State::offset_cnt / 16.0)) * 16;
+	// s0 covers [2048, 6143) of a frame too big for sp alone
+	Global_State::frame_base.push(mem > 2048 ? 2048 + 2047 : 0);
+	return mem;
 }
 
 void dfs_ir(const koopa_raw_program_t &prog, Outp &outstr) {
+	valmp.clear();
+	blk_id_mp.clear();
+	visited.clear();
 	for(size_t i = 0; i < prog.values.len; i++) {
 		koopa_raw_value_t val = (koopa_raw_value_t)prog.values.buffer[i];
 		dfs_ir(val, outstr);
@@ -277,6 +457,20 @@ void dfs_ir(const koopa_raw_program_t &prog, Outp &outstr) {
 	}
 }
 
+// Every value goes through its slot, so a value is often stored and read back
+// into the same register right away; the second access is dropped.
+void drop_reloads(const std::string &code, Outp &outstr) {
+	std::istringstream lines(code);
+	std::string line, last;
+	while(std::getline(lines, line)) {
+		if(line.starts_with("lw ") && last.starts_with("sw ") && line.substr(3) == last.substr(3)) {
+			continue;
+		}
+		outstr << line << "\n";
+		last = line;
+	}
+}
+
 void dfs_ir(const koopa_raw_function_t &func, Outp &outstr) {
 	if(func->bbs.len == 0) return;
 	outstr << ".text\n";
@@ -284,11 +478,22 @@ void dfs_ir(const koopa_raw_function_t &func, Outp &outstr) {
 	outstr << (func->name + 1) << ":\n";
 	int mem = get_function_mem(func);
 	Global_State::function_stack_mem.push(mem);
-	if(mem > 0) {
+	Global_State::stack_param_cnt.push(std::max((int)func->params.len - 8, 0));
+	if(is_imm12(-mem)) {
+		outstr << "addi sp, sp, " << -mem << "\n";
+	} else {
 		outstr << "li t0, " << -mem << "\nadd sp, sp, t0\n";
 	}
 	if(Global_State::save_ra.top()) {
-		access_sp("ra", mem - 4, true, outstr);
+		access_sp("ra", Global_State::reg_save_offset.top(), true, outstr);
+	}
+	if(Global_State::frame_base.top() != 0) {
+		access_sp("s0", Global_State::reg_save_offset.top() + 4, true, outstr);
+		outstr << "li t0, " << Global_State::frame_base.top() << "\n"
+			   << "add s0, sp, t0\n";
+	}
+	for(size_t i = 0; i < func->params.len && i < 8; i++) {
+		valmp[(void *)func->params.buffer[i]]->assign_from_reg("a" + std::to_string(i), outstr);
 	}
 	for(size_t i = 0; i < func->bbs.len; i++) {
 		assert(func->bbs.kind == KOOPA_RSIK_BASIC_BLOCK);
@@ -296,21 +501,53 @@ void dfs_ir(const koopa_raw_function_t &func, Outp &outstr) {
 		blk_id_mp[blk] = "block_" + std::to_string(Global_State::basic_blk_cnt);
 		Global_State::basic_blk_cnt++;
 	}
+	Outp body;
 	for(size_t i = 0; i < func->bbs.len; i++) {
 		assert(func->bbs.kind == KOOPA_RSIK_BASIC_BLOCK);
 		koopa_raw_basic_block_t blk = (koopa_raw_basic_block_t)func->bbs.buffer[i];
-		dfs_ir(blk, outstr);
+		dfs_ir(blk, body);
 	}
+	drop_reloads(body.str(), outstr);
 	Global_State::function_stack_mem.pop();
 	Global_State::save_ra.pop();
+	Global_State::reg_save_offset.pop();
+	Global_State::frame_base.pop();
+	Global_State::stack_param_cnt.pop();
 	// ret: sp -= mem;
 }
 
+// Whether ptr surely points outside our frame: into a global, or wherever a
+// pointer parameter points. Anything that cannot be traced may be local.
+bool outside_frame(koopa_raw_value_t ptr) {
+	while(ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR || ptr->kind.tag == KOOPA_RVT_GET_PTR) {
+		ptr = ptr->kind.data.get_elem_ptr.src;
+	}
+	return ptr->kind.tag == KOOPA_RVT_GLOBAL_ALLOC || ptr->kind.tag == KOOPA_RVT_FUNC_ARG_REF;
+}
+
+// A call whose result is returned at once, whose stack arguments fit where our
+// own caller put ours, and which gets no pointer into the frame it replaces.
+bool is_tail_call(koopa_raw_value_t call, koopa_raw_value_t ret) {
+	if(call->kind.tag != KOOPA_RVT_CALL || ret->kind.tag != KOOPA_RVT_RETURN) return false;
+	if(ret->kind.data.ret.value != nullptr && ret->kind.data.ret.value != call) return false;
+	auto &args = call->kind.data.call.args;
+	for(size_t i = 0; i < args.len; i++) {
+		auto arg = (koopa_raw_value_t)args.buffer[i];
+		if(arg->ty->tag == KOOPA_RTT_POINTER && !outside_frame(arg)) return false;
+	}
+	return (int)args.len - 8 <= Global_State::stack_param_cnt.top();
+}
+
 void dfs_ir(const koopa_raw_basic_block_t &blk, Outp &outstr) {
 	outstr << blk_id_mp[blk] << ":\n";
 	for(size_t i = 0; i < blk->insts.len; i++) {
 		assert(blk->insts.kind == KOOPA_RSIK_VALUE);
 		koopa_raw_value_t val = (koopa_raw_value_t)blk->insts.buffer[i];
+		if(i + 2 == blk->insts.len && is_tail_call(val, (koopa_raw_value_t)blk->insts.buffer[i + 1])) {
+			visited.insert((void *)val);
+			emit_call(val, true, outstr);
+			return;
+		}
 		dfs_ir(val, outstr);
 	}
 }
@@ -334,9 +571,48 @@ void aggregate_global_init(const koopa_raw_value_t &aggr, Outp &outstr) {
 	}
 }
 
+// Leaving SSA: the arguments of a jump are stored into the slots of the
+// target's parameters as one parallel copy. Copies go through t0, a cycle is
+// broken by keeping one old value in t1.
+void copy_block_args(koopa_raw_basic_block_t target, const koopa_raw_slice_t &args, Outp &outstr) {
+	class Copy {
+	public:
+		koopa_raw_value_t dest, src;
+		bool from_t1;
+	};
+	std::vector<Copy> pending;
+	for(size_t i = 0; i < args.len; i++) {
+		auto src = (koopa_raw_value_t)args.buffer[i];
+		auto dest = (koopa_raw_value_t)target->params.buffer[i];
+		dfs_ir(src, outstr);
+		if(src != dest) pending.push_back({dest, src, false});
+	}
+	auto is_read = [&](koopa_raw_value_t val) {
+		return std::any_of(pending.begin(), pending.end(), [&](const Copy &i) { return !i.from_t1 && i.src == val; });
+	};
+	while(!pending.empty()) {
+		auto it = std::find_if(pending.begin(), pending.end(), [&](const Copy &i) { return !is_read(i.dest); });
+		if(it == pending.end()) {
+			auto saved = pending.front().dest;
+			valmp[(void *)saved]->load_real_to_reg("t1", outstr);
+			for(auto &i : pending) {
+				if(i.src == saved) i.from_t1 = true;
+			}
+			continue;
+		}
+		if(it->from_t1) {
+			valmp[(void *)it->dest]->assign_real_from_reg("t1", outstr);
+		} else {
+			valmp[(void *)it->src]->load_real_to_reg("t0", outstr);
+			valmp[(void *)it->dest]->assign_real_from_reg("t0", outstr);
+		}
+		pending.erase(it);
+	}
+}
+
 void dfs_ir(const koopa_raw_value_t &val, Outp &outstr) {
 	const auto &kind = val->kind;
-	if(val->ty->tag != KOOPA_RTT_UNIT && kind.tag != KOOPA_RVT_INTEGER) {
+	if(val->ty->tag != KOOPA_RTT_UNIT && kind.tag != KOOPA_RVT_INTEGER && kind.tag != KOOPA_RVT_UNDEF) {
 		if(kind.tag == KOOPA_RVT_FUNC_ARG_REF || kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
 			if(valmp.contains((void *)val)) {
 				return;
@@ -364,27 +640,46 @@ void dfs_ir(const koopa_raw_value_t &val, Outp &outstr) {
 		if(valmp.contains((void *)val)) break;
 		valmp[(void *)val] = std::make_shared<Asm_val_im>(kind.data.integer.value);
 		break;
+	case KOOPA_RVT_UNDEF:
+		if(valmp.contains((void *)val)) break;
+		valmp[(void *)val] = std::make_shared<Asm_val_im>(0);
+		break;
 	case KOOPA_RVT_ALLOC:
+	case KOOPA_RVT_BLOCK_ARG_REF:
 		break;
 	case KOOPA_RVT_STORE:
 		dfs_ir(kind.data.store.value, outstr);
-		valmp[(void *)kind.data.store.value]->load_to_reg("t0", outstr);
+		valmp[(void *)kind.data.store.value]->load_real_to_reg("t0", outstr);
 		valmp[(void *)kind.data.store.dest]->assign_from_reg("t0", outstr);
 		break;
 	case KOOPA_RVT_LOAD:
 		valmp[(void *)kind.data.load.src]->load_to_reg("t0", outstr);
 		valmp[(void *)val]->assign_from_reg("t0", outstr);
 		break;
-	case KOOPA_RVT_BRANCH:
-		dfs_ir(kind.data.branch.cond, outstr);
-		valmp[(void *)kind.data.branch.cond]->load_to_reg("t0", outstr);
-		assert(blk_id_mp.contains(kind.data.branch.true_bb));
-		assert(blk_id_mp.contains(kind.data.branch.false_bb));
-		outstr << "bnez t0, " << blk_id_mp[kind.data.branch.true_bb] << "\n";
-		outstr << "j " << blk_id_mp[kind.data.branch.false_bb] << "\n";
+	case KOOPA_RVT_BRANCH: {
+		const auto &br = kind.data.branch;
+		dfs_ir(br.cond, outstr);
+		valmp[(void *)br.cond]->load_to_reg("t0", outstr);
+		assert(blk_id_mp.contains(br.true_bb));
+		assert(blk_id_mp.contains(br.false_bb));
+		// arguments are copied on the edge, the true edge gets a block of its own
+		std::string true_label = blk_id_mp[br.true_bb];
+		if(br.true_args.len > 0) {
+			true_label = "edge_" + std::to_string(Global_State::basic_blk_cnt++);
+		}
+		outstr << "bnez t0, " << true_label << "\n";
+		copy_block_args(br.false_bb, br.false_args, outstr);
+		outstr << "j " << blk_id_mp[br.false_bb] << "\n";
+		if(br.true_args.len > 0) {
+			outstr << true_label << ":\n";
+			copy_block_args(br.true_bb, br.true_args, outstr);
+			outstr << "j " << blk_id_mp[br.true_bb] << "\n";
+		}
 		break;
+	}
 	case KOOPA_RVT_JUMP:
 		assert(blk_id_mp.contains(kind.data.jump.target));
+		copy_block_args(kind.data.jump.target, kind.data.jump.args, outstr);
 		outstr << "j " << blk_id_mp[kind.data.jump.target] << "\n";
 		break;
 	case KOOPA_RVT_FUNC_ARG_REF: {
@@ -399,27 +694,22 @@ void dfs_ir(const koopa_raw_value_t &val, Outp &outstr) {
 		valmp[(void *)val] = asm_val;
 		break;
 	}
-	case KOOPA_RVT_CALL: {
-		auto &args = kind.data.call.args;
-		for(int i = 0; i < args.len; i++) {
-			dfs_ir((koopa_raw_value_t)args.buffer[i], outstr);
-			auto asm_val = valmp[(void *)args.buffer[i]];
-			asm_val->load_real_to_reg("t0", outstr);
-			if(i < 8) {
-				outstr << "mv a" << i << ", t0\n";
-			} else {
-				access_sp("t0", (i - 8) * 4, true, outstr);
-			}
-		}
-		outstr << "call " << kind.data.call.callee->name + 1 << "\n";
-		if(kind.data.call.callee->ty->data.function.ret->tag != KOOPA_RTT_UNIT) {
-			valmp[(void *)val]->assign_from_reg("a0", outstr);
-		}
+	case KOOPA_RVT_CALL:
+		emit_call(val, false, outstr);
 		break;
-	}
 	case KOOPA_RVT_GLOBAL_ALLOC:
-		outstr << ".data\n"
-			   << ".global " << (val->name + 1) << "\n"
+		valmp[(void *)val] = std::make_shared<Asm_val_globalvar>(val->name + 1);
+		if(!emitted_globals.insert(val->name + 1).second) {
+			break;
+		}
+		if(rodata_symbols.contains(val->name + 1)) {
+			outstr << ".section .rodata\n";
+		} else if(kind.data.global_alloc.init->kind.tag == KOOPA_RVT_ZERO_INIT) {
+			outstr << ".bss\n";
+		} else {
+			outstr << ".data\n";
+		}
+		outstr << ".global " << (val->name + 1) << "\n"
 			   << (val->name + 1) << ":\n";
 		aggregate_global_init(kind.data.global_alloc.init, outstr);
 		// if(kind.data.global_alloc.init->kind.tag == KOOPA_RVT_ZERO_INIT) {
@@ -427,48 +717,246 @@ void dfs_ir(const koopa_raw_value_t &val, Outp &outstr) {
 		// } else {
 		// 	outstr << ".word " << kind.data.global_alloc.init->kind.data.integer.value << "\n";
 		// }
-		valmp[(void *)val] = std::make_shared<Asm_val_globalvar>(val->name + 1);
 		break;
 	case KOOPA_RVT_GET_ELEM_PTR:
-	case KOOPA_RVT_GET_PTR:
+	case KOOPA_RVT_GET_PTR: {
 		dfs_ir(kind.data.get_elem_ptr.src, outstr);
 		dfs_ir(kind.data.get_elem_ptr.index, outstr);
+		if(offset_ptrs.contains(val)) {
+			break;
+		}
 		if(kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
 			valmp[(void *)kind.data.get_elem_ptr.src]->load_addr_to_reg("t0", outstr);
 		} else {
-			valmp[(void *)kind.data.get_elem_ptr.src]->load_to_reg("t0", outstr);
+			valmp[(void *)kind.data.get_elem_ptr.src]->load_real_to_reg("t0", outstr);
+		}
+		koopa_raw_type_t pointee = kind.data.get_elem_ptr.src->ty->data.pointer.base;
+		int size = get_array_size(kind.tag == KOOPA_RVT_GET_PTR ? pointee : pointee->data.array.base);
+		auto index = kind.data.get_elem_ptr.index;
+		// a constant index is a constant offset, a power of two size a shift
+		if(index->kind.tag == KOOPA_RVT_INTEGER) {
+			int offset = (int)((uint32_t)index->kind.data.integer.value * size);
+			if(is_imm12(offset)) {
+				if(offset != 0) outstr << "addi t0, t0, " << offset << "\n";
+			} else {
+				outstr << "li t1, " << offset << "\n"
+					   << "add t0, t0, t1\n";
+			}
+		} else {
+			valmp[(void *)index]->load_to_reg("t1", outstr);
+			if(std::has_single_bit((unsigned)size)) {
+				outstr << "slli t1, t1, " << std::countr_zero((unsigned)size) << "\n";
+			} else {
+				outstr << "li t2, " << size << "\n"
+					   << "mul t1, t1, t2\n";
+			}
+			outstr << "add t0, t0, t1\n";
 		}
-		valmp[(void *)kind.data.get_elem_ptr.index]->load_to_reg("t1", outstr);
-		outstr << "li t2, "
-			   << get_array_size(kind.data.get_elem_ptr.src) /
-					  get_array_len(kind.data.get_elem_ptr.src)
-			   << "\n";
-		outstr << "mul t1, t1, t2\n"
-			   << "add t0, t0, t1\n";
 		valmp[(void *)val]->assign_addr_from_reg("t0", outstr);
 		break;
+	}
 	default:
 		std::cerr << "koopa_raw_value_t not handled: " << kind.tag << '\n';
 		assert(0);
 	}
 }
 
+// A tail call leaves through the epilogue and jumps, its stack arguments are
+// moved up into the area of our incoming ones first.
+void emit_call(const koopa_raw_value_t &val, bool is_tail, Outp &outstr) {
+	const auto &call = val->kind.data.call;
+	auto &args = call.args;
+	for(int i = 0; i < args.len; i++) {
+		dfs_ir((koopa_raw_value_t)args.buffer[i], outstr);
+		auto asm_val = valmp[(void *)args.buffer[i]];
+		asm_val->load_real_to_reg("t0", outstr);
+		if(i < 8) {
+			outstr << "mv a" << i << ", t0\n";
+		} else {
+			access_sp("t0", (i - 8) * 4, true, outstr);
+		}
+	}
+	if(is_tail) {
+		for(size_t i = 8; i < args.len; i++) {
+			access_sp("t0", (i - 8) * 4, false, outstr);
+			access_sp("t0", Global_State::function_stack_mem.top() + (i - 8) * 4, true, outstr);
+		}
+		emit_epilogue(outstr);
+		outstr << "tail " << call.callee->name + 1 << "\n";
+		return;
+	}
+	outstr << "call " << call.callee->name + 1 << "\n";
+	if(call.callee->ty->data.function.ret->tag != KOOPA_RTT_UNIT) {
+		valmp[(void *)val]->assign_from_reg("a0", outstr);
+	}
+}
+
+void emit_epilogue(Outp &outstr) {
+	int mem = Global_State::function_stack_mem.top();
+	if(Global_State::save_ra.top()) {
+		access_sp("ra", Global_State::reg_save_offset.top(), false, outstr);
+	}
+	if(Global_State::frame_base.top() != 0) {
+		access_sp("s0", Global_State::reg_save_offset.top() + 4, false, outstr);
+	}
+	if(is_imm12(mem)) {
+		outstr << "addi sp, sp, " << mem << "\n";
+	} else {
+		outstr << "li t0, " << mem << "\n"
+			   << "add sp, sp, t0\n";
+	}
+}
+
 void dfs_ir(const koopa_raw_return_t &ret, Outp &outstr) {
 	if(ret.value != nullptr) {
 		dfs_ir(ret.value, outstr);
 		valmp[(void *)ret.value]->load_to_reg("a0", outstr);
 	}
-	int mem = Global_State::function_stack_mem.top();
-	if(Global_State::save_ra.top()) {
-		access_sp("ra", mem - 4, false, outstr);
+	emit_epilogue(outstr);
+	outstr << "ret\n";
+}
+
+namespace Strength_Reduce {
+
+// Multiplier and shift for signed division by d, |d| >= 2 (Hacker's Delight 10-1).
+std::pair<int32_t, int> div_magic(int32_t d) {
+	const uint32_t two31 = 0x80000000u;
+	uint32_t ad = d < 0 ? -(uint32_t)d : d;
+	uint32_t t = two31 + ((uint32_t)d >> 31);
+	uint32_t anc = t - 1 - t % ad;
+	int p = 31;
+	uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+	uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+	uint32_t delta;
+	do {
+		p++;
+		q1 *= 2;
+		r1 *= 2;
+		if(r1 >= anc) {
+			q1++;
+			r1 -= anc;
+		}
+		q2 *= 2;
+		r2 *= 2;
+		if(r2 >= ad) {
+			q2++;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while(q1 < delta || (q1 == delta && r1 == 0));
+	int32_t magic = (int32_t)(q2 + 1);
+	return {d < 0 ? -magic : magic, p - 32};
+}
+
+// t0 = t0 * c using t1, false if c has too many bits set.
+bool mul_const(int32_t c, Outp &outstr) {
+	uint32_t u = c < 0 ? -(uint32_t)c : c;
+	if(u == 0) {
+		outstr << "li t0, 0\n";
+		return true;
+	}
+	int low = std::countr_zero(u);
+	if(std::has_single_bit(u)) {
+		if(low > 0) outstr << "slli t0, t0, " << low << "\n";
+	} else if(std::popcount(u) == 2) {
+		outstr << "slli t1, t0, " << 31 - std::countl_zero(u) << "\n";
+		if(low > 0) outstr << "slli t0, t0, " << low << "\n";
+		outstr << "add t0, t1, t0\n";
+	} else if(uint32_t top = u + (1u << low); top != 0 && std::has_single_bit(top)) {
+		// a run of ones: 2^a - 2^b
+		outstr << "slli t1, t0, " << std::countr_zero(top) << "\n";
+		if(low > 0) outstr << "slli t0, t0, " << low << "\n";
+		outstr << "sub t0, t1, t0\n";
+	} else {
+		return false;
+	}
+	if(c < 0) outstr << "neg t0, t0\n";
+	return true;
+}
+
+// t0 = t0 / c or t0 % c with RV32 rounding using t1 and t2, false if the
+// plain instruction should be used.
+bool div_const(int32_t c, bool is_mod, Outp &outstr) {
+	if(c == 0 || c == INT32_MIN) {
+		return false;
+	}
+	if(c == 1 || c == -1) {
+		outstr << (is_mod ? "li t0, 0\n" : (c == -1 ? "neg t0, t0\n" : ""));
+		return true;
+	}
+	uint32_t u = c < 0 ? -(uint32_t)c : c;
+	if(std::has_single_bit(u)) {
+		int k = std::countr_zero(u);
+		// bias negative dividends by 2^k - 1 so that the shift rounds toward zero
+		outstr << "srai t1, t0, 31\n"
+			   << "srli t1, t1, " << 32 - k << "\n";
+		if(is_mod) {
+			outstr << "add t2, t0, t1\n";
+			if(u - 1 <= 2047) {
+				outstr << "andi t2, t2, " << u - 1 << "\n";
+			} else {
+				outstr << "slli t2, t2, " << 32 - k << "\n"
+					   << "srli t2, t2, " << 32 - k << "\n";
+			}
+			outstr << "sub t0, t2, t1\n";
+		} else {
+			outstr << "add t0, t0, t1\n"
+				   << "srai t0, t0, " << k << "\n";
+			if(c < 0) outstr << "neg t0, t0\n";
+		}
+		return true;
 	}
-	if(mem > 0) {
-		outstr << "li t0, " << mem << "\n";
+	auto [magic, shift] = div_magic(c);
+	outstr << "li t1, " << magic << "\n"
+		   << "mulh t1, t0, t1\n";
+	if(c > 0 && magic < 0) outstr << "add t1, t1, t0\n";
+	if(c < 0 && magic > 0) outstr << "sub t1, t1, t0\n";
+	if(shift > 0) outstr << "srai t1, t1, " << shift << "\n";
+	outstr << "srli t2, t1, 31\n"
+		   << "add t1, t1, t2\n";
+	if(is_mod) {
+		outstr << "li t2, " << c << "\n"
+			   << "mul t1, t1, t2\n"
+			   << "sub t0, t0, t1\n";
+	} else {
+		outstr << "mv t0, t1\n";
 	}
-	outstr << "add sp, sp, t0\nret\n";
-	return;
+	return true;
 }
 
+// Emits bin into t0 when it is a mul/div/mod by a constant that can be done
+// without the multiplier or divider.
+bool try_emit(const koopa_raw_binary_t &bin, Outp &outstr) {
+	koopa_raw_value_t var = bin.lhs, imm = bin.rhs;
+	if(bin.op == KOOPA_RBO_MUL && var->kind.tag == KOOPA_RVT_INTEGER) {
+		std::swap(var, imm);
+	}
+	if(imm->kind.tag != KOOPA_RVT_INTEGER) {
+		return false;
+	}
+	int32_t c = imm->kind.data.integer.value;
+	std::ostringstream code;
+	bool done = false;
+	switch(bin.op) {
+	case KOOPA_RBO_MUL:
+		done = mul_const(c, code);
+		break;
+	case KOOPA_RBO_DIV:
+	case KOOPA_RBO_MOD:
+		done = div_const(c, bin.op == KOOPA_RBO_MOD, code);
+		break;
+	default:
+		break;
+	}
+	if(done) {
+		valmp[(void *)var]->load_to_reg("t0", outstr);
+		outstr << code.str();
+	}
+	return done;
+}
+
+}   // namespace Strength_Reduce
+
 void dfs_ir(const koopa_raw_binary_t &bin, Outp &outstr) {
 	assert(valmp.contains((void *)&bin));
 	if(visited.contains((void *)&bin)) {
@@ -478,6 +966,10 @@ void dfs_ir(const koopa_raw_binary_t &bin, Outp &outstr) {
 	}
 	dfs_ir(bin.lhs, outstr);
 	dfs_ir(bin.rhs, outstr);
+	if(Strength_Reduce::try_emit(bin, outstr)) {
+		valmp[(void *)&bin]->assign_from_reg("t0", outstr);
+		return;
+	}
 	valmp[(void *)bin.lhs]->load_to_reg("t0", outstr);
 	valmp[(void *)bin.rhs]->load_to_reg("t1", outstr);
 	switch(bin.op) {
@@ -2,9 +2,14 @@
 
 #include "koopa.h"
 #include <sstream>
+#include <string>
+#include <unordered_set>
 
 using Outp = std::ostringstream;
 
+// Globals (names without '@') that are never written and can live in .rodata.
+void set_rodata_symbols(std::unordered_set<std::string> syms);
+
 void dfs_ir(const koopa_raw_program_t& prog, Outp& outstr);
 void dfs_ir(const koopa_raw_function_t& func, Outp& outstr);
 void dfs_ir(const koopa_raw_basic_block_t& blk, Outp& outstr);
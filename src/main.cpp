@@ -1,8 +1,11 @@
 #include <cassert>
+#include <cctype>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 // #include <argp.h>
 #include "koopa.h"
 #include <getopt.h>
@@ -12,6 +15,8 @@ extern FILE *yyin;
 
 #include "ast_defs.hpp"
 #include "ir.hpp"
+#include "opt.hpp"
+#include "options.hpp"
 extern int yyparse(std::unique_ptr<BaseAST> &);
 
 extern char *optarg;
@@ -23,10 +28,119 @@ static const struct option long_opt_args[] = {
 	{"r", no_argument, NULL, 1002},
 	{"output", required_argument, NULL, 1003},
 	{"o", required_argument, NULL, 1003},
+	{"fmemoize-pure", no_argument, NULL, 1004},
+	{"fopt-report", no_argument, NULL, 1005},
+	{"O0", no_argument, NULL, 1006},
+	{"O1", no_argument, NULL, 1007},
+	{"stream", no_argument, NULL, 1008},
+	{"finline-threshold", required_argument, NULL, 1009},
+	{"finline-report", no_argument, NULL, 1010},
+	{"funroll-factor", required_argument, NULL, 1011},
 	{0, 0, 0, 0}};
 
 bool output_koopa = false;
 
+namespace Options {
+bool memoize_pure = false;
+bool opt_report = false;
+bool optimize = true;
+bool stream = false;
+int inline_threshold = 30;
+bool inline_report = false;
+int unroll_factor = 4;
+}   // namespace Options
+
+// What earlier programs of a stream defined, by name without '@': functions
+// as decls, globals as zeroinit allocs (the backend only emits the first
+// definition of a global).
+std::unordered_map<std::string, std::string> stream_decls;
+
+std::string type_str(koopa_raw_type_t ty) {
+	switch(ty->tag) {
+	case KOOPA_RTT_INT32:
+		return "i32";
+	case KOOPA_RTT_ARRAY:
+		return "[" + type_str(ty->data.array.base) + ", " + std::to_string(ty->data.array.len) + "]";
+	case KOOPA_RTT_POINTER:
+		return "*" + type_str(ty->data.pointer.base);
+	default:
+		assert(0);
+		return "";
+	}
+}
+
+void register_decls(const koopa_raw_program_t &prog) {
+	for(size_t i = 0; i < prog.values.len; i++) {
+		auto val = (koopa_raw_value_t)prog.values.buffer[i];
+		stream_decls[val->name + 1] = "global " + std::string(val->name) + " = alloc " + type_str(val->ty->data.pointer.base) + ", zeroinit\n";
+	}
+	for(size_t i = 0; i < prog.funcs.len; i++) {
+		auto func = (koopa_raw_function_t)prog.funcs.buffer[i];
+		if(func->bbs.len == 0) continue;
+		auto &ty = func->ty->data.function;
+		std::string decl = "decl " + std::string(func->name) + "(";
+		for(size_t j = 0; j < ty.params.len; j++) {
+			decl += (j == 0 ? "" : ", ") + type_str((koopa_raw_type_t)ty.params.buffer[j]);
+		}
+		decl += ")";
+		if(ty.ret->tag != KOOPA_RTT_UNIT) {
+			decl += ": " + type_str(ty.ret);
+		}
+		stream_decls[func->name + 1] = decl + "\n";
+	}
+}
+
+// The declarations of earlier definitions that a program uses, with the
+// globals the functions it calls touch.
+std::string used_decls(const std::string &koopa_str) {
+	std::string ret;
+	std::unordered_set<std::string> seen;
+	std::vector<std::string> names;
+	for(size_t i = koopa_str.find('@'); i != std::string::npos; i = koopa_str.find('@', i)) {
+		size_t end = ++i;
+		while(end < koopa_str.size() && (isalnum(koopa_str[end]) || koopa_str[end] == '_')) end++;
+		names.push_back(koopa_str.substr(i, end - i));
+	}
+	while(!names.empty()) {
+		auto name = std::move(names.back());
+		names.pop_back();
+		auto it = stream_decls.find(name);
+		if(it == stream_decls.end() || !seen.insert(name).second) continue;
+		ret += it->second;
+		for(auto &i : Koopa_Opt::saved_mod_ref_globals("@" + name)) {
+			names.push_back(i.substr(1));
+		}
+	}
+	return ret;
+}
+
+// Koopa text -> RISC-V, appended to out.
+void lower_to_riscv(const std::string &koopa_str, std::ostream &out) {
+	koopa_raw_program_t raw_prog;
+	koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
+	do {
+		koopa_program_t program;
+		koopa_error_code_t ret = koopa_parse_from_string(koopa_str.c_str(), &program);
+		assert(ret == KOOPA_EC_SUCCESS);   // 确保解析时没有出错
+		raw_prog = koopa_build_raw_program(builder, program);
+		koopa_delete_program(program);
+	} while(0);
+
+	if(Options::stream) {
+		register_decls(raw_prog);
+	}
+	if(Options::optimize) {
+		Koopa_Opt::optimize_ir(raw_prog);
+	}
+
+	std::ostringstream outstrbuf;
+	set_rodata_symbols(Ast_Base::readonly_globals);
+	dfs_ir(raw_prog, outstrbuf);
+	out << outstrbuf.str();
+
+	koopa_delete_raw_program_builder(builder);
+}
+
 int main(int argc, char **argv) {
 	int now_opt = 0;
 	std::string outp;
@@ -42,6 +156,30 @@ int main(int argc, char **argv) {
 		case 1003:
 			outp = optarg;
 			break;
+		case 1004:
+			Options::memoize_pure = true;
+			break;
+		case 1005:
+			Options::opt_report = true;
+			break;
+		case 1006:
+			Options::optimize = false;
+			break;
+		case 1007:
+			Options::optimize = true;
+			break;
+		case 1008:
+			Options::stream = true;
+			break;
+		case 1009:
+			Options::inline_threshold = std::stoi(optarg);
+			break;
+		case 1010:
+			Options::inline_report = true;
+			break;
+		case 1011:
+			Options::unroll_factor = std::stoi(optarg);
+			break;
 		case '?':
 			std::cerr << "Never gonna give you up\n"
 					  << argv[opt_index] << "\n";
@@ -54,6 +192,45 @@ int main(int argc, char **argv) {
 	yyin = fopen(argv[optind], "r");
 	assert(yyin);
 
+	std::ofstream outp_file;
+	if(!outp.empty()) {
+		outp_file.open(outp);
+	}
+	std::ostream &out = outp.empty() ? std::cout : outp_file;
+
+	if(Options::stream) {
+		// Each top-level item is emitted, lowered and written as soon as it is
+		// parsed, then its AST is dropped and its arena memory reused.
+		bool is_first = true;
+		Ast_Base::Arena::Mark item_start;
+		top_level_hook = [&](CompUnitAST &unit) {
+			if(unit.decls.empty()) {
+				// the unit itself is kept, items start after it
+				CompUnitAST::enter_global_scope();
+				item_start = Ast_Base::ast_arena.mark();
+				return;
+			}
+			std::ostringstream libbuf, itembuf;
+			Ast_Base::Ost lib_ost(libbuf), item_ost(itembuf);
+			CompUnitAST::output_lib_decls(lib_ost);
+			CompUnitAST::output_item(unit.decls.back(), item_ost, "");
+			// destroyed before its memory is
+			unit.decls.pop_back();
+			Ast_Base::ast_arena.rewind(item_start);
+			if(output_koopa) {
+				out << (is_first ? libbuf.str() : "") << itembuf.str();
+			} else {
+				lower_to_riscv(libbuf.str() + used_decls(itembuf.str()) + itembuf.str(), out);
+			}
+			is_first = false;
+		};
+		std::unique_ptr<BaseAST> ast;
+		auto ret = yyparse(ast);
+		assert(!ret);
+		CompUnitAST::exit_global_scope();
+		return 0;
+	}
+
 	std::unique_ptr<BaseAST> ast;
 	do {
 		auto ret = yyparse(ast);
@@ -66,38 +243,15 @@ int main(int argc, char **argv) {
 
 	ast->output(ost, "");
 	outstr = outstrbuf.str();
+	// the nodes are not destroyed one by one, their memory goes with the arena
+	ast.release();
+	Ast_Base::ast_arena.release();
 
 	if(output_koopa) {
-		if(outp.empty()) {
-			std::cout << outstr;
-		} else {
-			std::ofstream outp_stream(outp);
-			outp_stream << outstr;
-		}
+		out << outstr;
 		return 0;
 	}
 
-	koopa_raw_program_t raw_prog;
-	koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-	do {
-		koopa_program_t program;
-		koopa_error_code_t ret = koopa_parse_from_string(outstr.c_str(), &program);
-		assert(ret == KOOPA_EC_SUCCESS);   // 确保解析时没有出错
-		raw_prog = koopa_build_raw_program(builder, program);
-		koopa_delete_program(program);
-	} while(0);
-
-	outstrbuf.str("");
-	dfs_ir(raw_prog, outstrbuf);
-	outstr = outstrbuf.str();
-
-	if(outp.empty()) {
-		std::cout << outstr;
-	} else {
-		std::ofstream outp_stream(outp);
-		outp_stream << outstr;
-	}
-
-	koopa_delete_raw_program_builder(builder);
+	lower_to_riscv(outstr, out);
 	return 0;
 }
@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <iostream>
+#include <list>
+
+#include "opt.hpp"
+#include "options.hpp"
+
+namespace Koopa_Opt {
+
+namespace Pool {
+
+std::deque<koopa_raw_value_data_t> values;
+std::deque<koopa_raw_basic_block_data_t> blocks;
+std::list<std::vector<const void *>> slices;
+koopa_raw_type_kind_t i32_type = {KOOPA_RTT_INT32, {}};
+koopa_raw_type_kind_t unit_ty = {KOOPA_RTT_UNIT, {}};
+
+}   // namespace Pool
+
+koopa_raw_value_data_t *mut(koopa_raw_value_t val) {
+	return const_cast<koopa_raw_value_data_t *>(val);
+}
+
+koopa_raw_basic_block_data_t *mut(koopa_raw_basic_block_t blk) {
+	return const_cast<koopa_raw_basic_block_data_t *>(blk);
+}
+
+koopa_raw_function_data_t *mut(koopa_raw_function_t func) {
+	return const_cast<koopa_raw_function_data_t *>(func);
+}
+
+koopa_raw_type_t int_type() {
+	return &Pool::i32_type;
+}
+
+koopa_raw_type_t unit_type() {
+	return &Pool::unit_ty;
+}
+
+koopa_raw_value_data_t *new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag) {
+	auto &val = Pool::values.emplace_back();
+	val.ty = ty;
+	val.name = nullptr;
+	val.used_by = make_slice({}, KOOPA_RSIK_VALUE);
+	val.kind.tag = tag;
+	return &val;
+}
+
+koopa_raw_value_t new_integer(int x) {
+	auto val = new_value(int_type(), KOOPA_RVT_INTEGER);
+	val->kind.data.integer.value = x;
+	return val;
+}
+
+koopa_raw_basic_block_data_t *new_block(const char *name) {
+	auto &blk = Pool::blocks.emplace_back();
+	blk.name = name;
+	blk.params = make_slice({}, KOOPA_RSIK_VALUE);
+	blk.used_by = make_slice({}, KOOPA_RSIK_VALUE);
+	blk.insts = make_slice({}, KOOPA_RSIK_VALUE);
+	return &blk;
+}
+
+koopa_raw_slice_t make_slice(const std::vector<const void *> &items, koopa_raw_slice_item_kind_t kind) {
+	auto &buf = Pool::slices.emplace_back(items);
+	return koopa_raw_slice_t{buf.data(), (uint32_t)buf.size(), kind};
+}
+
+std::vector<koopa_raw_basic_block_t> get_blocks(koopa_raw_function_t func) {
+	return to_vector<koopa_raw_basic_block_t>(func->bbs);
+}
+
+std::vector<koopa_raw_value_t> get_insts(koopa_raw_basic_block_t blk) {
+	return to_vector<koopa_raw_value_t>(blk->insts);
+}
+
+void set_blocks(koopa_raw_function_t func, const std::vector<koopa_raw_basic_block_t> &blks) {
+	mut(func)->bbs = make_slice(std::vector<const void *>(blks.begin(), blks.end()), KOOPA_RSIK_BASIC_BLOCK);
+}
+
+void set_insts(koopa_raw_basic_block_t blk, const std::vector<koopa_raw_value_t> &insts) {
+	mut(blk)->insts = make_slice(std::vector<const void *>(insts.begin(), insts.end()), KOOPA_RSIK_VALUE);
+}
+
+bool is_terminator(koopa_raw_value_t val) {
+	auto tag = val->kind.tag;
+	return tag == KOOPA_RVT_BRANCH || tag == KOOPA_RVT_JUMP || tag == KOOPA_RVT_RETURN;
+}
+
+koopa_raw_value_t get_terminator(koopa_raw_basic_block_t blk) {
+	assert(blk->insts.len > 0);
+	auto val = (koopa_raw_value_t)blk->insts.buffer[blk->insts.len - 1];
+	assert(is_terminator(val));
+	return val;
+}
+
+std::vector<koopa_raw_basic_block_t> get_successors(koopa_raw_basic_block_t blk) {
+	auto term = get_terminator(blk);
+	switch(term->kind.tag) {
+	case KOOPA_RVT_BRANCH:
+		return {term->kind.data.branch.true_bb, term->kind.data.branch.false_bb};
+	case KOOPA_RVT_JUMP:
+		return {term->kind.data.jump.target};
+	default:
+		return {};
+	}
+}
+
+void retarget(koopa_raw_value_t term, koopa_raw_basic_block_t from, koopa_raw_basic_block_t to) {
+	auto &kind = mut(term)->kind;
+	if(kind.tag == KOOPA_RVT_JUMP) {
+		if(kind.data.jump.target == from) kind.data.jump.target = to;
+	} else if(kind.tag == KOOPA_RVT_BRANCH) {
+		if(kind.data.branch.true_bb == from) kind.data.branch.true_bb = to;
+		if(kind.data.branch.false_bb == from) kind.data.branch.false_bb = to;
+	}
+}
+
+int edge_count(koopa_raw_value_t term) {
+	auto tag = term->kind.tag;
+	return tag == KOOPA_RVT_BRANCH ? 2 : tag == KOOPA_RVT_JUMP ? 1 : 0;
+}
+
+koopa_raw_basic_block_t &edge_target(koopa_raw_value_t term, int succ) {
+	auto &kind = mut(term)->kind;
+	if(kind.tag == KOOPA_RVT_JUMP) return kind.data.jump.target;
+	return succ == 0 ? kind.data.branch.true_bb : kind.data.branch.false_bb;
+}
+
+koopa_raw_slice_t &edge_args(koopa_raw_value_t term, int succ) {
+	auto &kind = mut(term)->kind;
+	if(kind.tag == KOOPA_RVT_JUMP) return kind.data.jump.args;
+	return succ == 0 ? kind.data.branch.true_args : kind.data.branch.false_args;
+}
+
+koopa_raw_value_t constant_through(koopa_raw_basic_block_t blk, koopa_raw_value_t val, const Cfg &cfg) {
+	auto params = to_vector<koopa_raw_value_t>(blk->params);
+	size_t index = std::find(params.begin(), params.end(), val) - params.begin();
+	if(index == params.size()) return val;
+	koopa_raw_value_t ret = nullptr;
+	for(auto pred : cfg.preds.at(blk)) {
+		auto term = get_terminator(pred);
+		for(int i = 0; i < edge_count(term); i++) {
+			if(edge_target(term, i) != blk) continue;
+			auto arg = (koopa_raw_value_t)edge_args(term, i).buffer[index];
+			if(arg->kind.tag != KOOPA_RVT_INTEGER) return val;
+			if(ret != nullptr && ret->kind.data.integer.value != arg->kind.data.integer.value) return val;
+			ret = arg;
+		}
+	}
+	return ret == nullptr ? val : ret;
+}
+
+koopa_raw_binary_op_t swap_sides(koopa_raw_binary_op_t op) {
+	switch(op) {
+	case KOOPA_RBO_LT: return KOOPA_RBO_GT;
+	case KOOPA_RBO_GT: return KOOPA_RBO_LT;
+	case KOOPA_RBO_LE: return KOOPA_RBO_GE;
+	case KOOPA_RBO_GE: return KOOPA_RBO_LE;
+	default: return op;
+	}
+}
+
+koopa_raw_binary_op_t negate(koopa_raw_binary_op_t op) {
+	switch(op) {
+	case KOOPA_RBO_LT: return KOOPA_RBO_GE;
+	case KOOPA_RBO_GE: return KOOPA_RBO_LT;
+	case KOOPA_RBO_GT: return KOOPA_RBO_LE;
+	case KOOPA_RBO_LE: return KOOPA_RBO_GT;
+	case KOOPA_RBO_EQ: return KOOPA_RBO_NOT_EQ;
+	default: return KOOPA_RBO_EQ;
+	}
+}
+
+bool holds(koopa_raw_binary_op_t op, int32_t a, int32_t b) {
+	switch(op) {
+	case KOOPA_RBO_LT: return a < b;
+	case KOOPA_RBO_LE: return a <= b;
+	case KOOPA_RBO_GT: return a > b;
+	case KOOPA_RBO_GE: return a >= b;
+	case KOOPA_RBO_EQ: return a == b;
+	default: return a != b;
+	}
+}
+
+static void for_each_in_slice(koopa_raw_slice_t &slice, const std::function<void(koopa_raw_value_t &)> &fn) {
+	for(size_t i = 0; i < slice.len; i++) {
+		fn(reinterpret_cast<koopa_raw_value_t &>(slice.buffer[i]));
+	}
+}
+
+void for_each_operand(koopa_raw_value_t val, const std::function<void(koopa_raw_value_t &)> &fn) {
+	auto &kind = mut(val)->kind;
+	switch(kind.tag) {
+	case KOOPA_RVT_BINARY:
+		fn(kind.data.binary.lhs);
+		fn(kind.data.binary.rhs);
+		break;
+	case KOOPA_RVT_LOAD:
+		fn(kind.data.load.src);
+		break;
+	case KOOPA_RVT_STORE:
+		fn(kind.data.store.value);
+		fn(kind.data.store.dest);
+		break;
+	case KOOPA_RVT_GET_PTR:
+	case KOOPA_RVT_GET_ELEM_PTR:
+		fn(kind.data.get_elem_ptr.src);
+		fn(kind.data.get_elem_ptr.index);
+		break;
+	case KOOPA_RVT_BRANCH:
+		fn(kind.data.branch.cond);
+		for_each_in_slice(kind.data.branch.true_args, fn);
+		for_each_in_slice(kind.data.branch.false_args, fn);
+		break;
+	case KOOPA_RVT_JUMP:
+		for_each_in_slice(kind.data.jump.args, fn);
+		break;
+	case KOOPA_RVT_CALL:
+		for_each_in_slice(kind.data.call.args, fn);
+		break;
+	case KOOPA_RVT_RETURN:
+		if(kind.data.ret.value != nullptr) {
+			fn(kind.data.ret.value);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void replace_uses(koopa_raw_function_t func, const std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> &replace) {
+	if(replace.empty()) return;
+	auto resolve = [&](koopa_raw_value_t val) {
+		// replacements may chain when a forwarded value is itself replaced
+		for(auto it = replace.find(val); it != replace.end(); it = replace.find(val)) {
+			val = it->second;
+		}
+		return val;
+	};
+	for(auto blk : get_blocks(func)) {
+		for(auto inst : get_insts(blk)) {
+			for_each_operand(inst, [&](koopa_raw_value_t &opr) {
+				opr = resolve(opr);
+			});
+		}
+	}
+}
+
+bool has_side_effect(koopa_raw_value_t val) {
+	switch(val->kind.tag) {
+	case KOOPA_RVT_BINARY:
+	case KOOPA_RVT_LOAD:
+	case KOOPA_RVT_GET_PTR:
+	case KOOPA_RVT_GET_ELEM_PTR:
+	case KOOPA_RVT_ALLOC:
+		return false;
+	default:
+		return true;
+	}
+}
+
+// Calls fn on the target and the arguments of every edge of term.
+static void for_each_edge(koopa_raw_value_t term, const std::function<void(koopa_raw_basic_block_t, koopa_raw_slice_t &)> &fn) {
+	auto &kind = mut(term)->kind;
+	if(kind.tag == KOOPA_RVT_JUMP) {
+		fn(kind.data.jump.target, kind.data.jump.args);
+	} else if(kind.tag == KOOPA_RVT_BRANCH) {
+		fn(kind.data.branch.true_bb, kind.data.branch.true_args);
+		fn(kind.data.branch.false_bb, kind.data.branch.false_args);
+	}
+}
+
+int remove_dead_values(koopa_raw_function_t func) {
+	// marked from what has a side effect, a parameter is live only if its
+	// value is, and only then the arguments passed to it
+	auto blks = get_blocks(func);
+	std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> incoming;
+	std::unordered_set<koopa_raw_value_t> live;
+	std::vector<koopa_raw_value_t> work;
+	auto mark = [&](koopa_raw_value_t val) {
+		if(live.insert(val).second) work.push_back(val);
+	};
+	for(auto blk : blks) {
+		for(auto inst : get_insts(blk)) {
+			for_each_edge(inst, [&](koopa_raw_basic_block_t target, koopa_raw_slice_t &args) {
+				for(size_t i = 0; i < args.len; i++) {
+					incoming[(koopa_raw_value_t)target->params.buffer[i]].push_back((koopa_raw_value_t)args.buffer[i]);
+				}
+			});
+			if(has_side_effect(inst)) mark(inst);
+		}
+	}
+	while(!work.empty()) {
+		auto val = work.back();
+		work.pop_back();
+		switch(val->kind.tag) {
+		case KOOPA_RVT_BLOCK_ARG_REF:
+			for(auto arg : incoming[val]) {
+				mark(arg);
+			}
+			break;
+		case KOOPA_RVT_JUMP:
+			break;
+		case KOOPA_RVT_BRANCH:
+			mark(val->kind.data.branch.cond);
+			break;
+		default:
+			for_each_operand(val, [&](koopa_raw_value_t &opr) { mark(opr); });
+			break;
+		}
+	}
+	int removed = 0;
+	for(auto blk : blks) {
+		std::vector<koopa_raw_value_t> insts;
+		for(auto inst : get_insts(blk)) {
+			if(live.contains(inst)) {
+				insts.push_back(inst);
+			} else {
+				removed++;
+			}
+		}
+		if(insts.size() != blk->insts.len) set_insts(blk, insts);
+		for_each_edge(get_terminator(blk), [&](koopa_raw_basic_block_t target, koopa_raw_slice_t &args) {
+			std::vector<const void *> kept;
+			for(size_t i = 0; i < args.len; i++) {
+				if(live.contains((koopa_raw_value_t)target->params.buffer[i])) kept.push_back(args.buffer[i]);
+			}
+			if(kept.size() != args.len) args = make_slice(kept, KOOPA_RSIK_VALUE);
+		});
+	}
+	for(auto blk : blks) {
+		std::vector<const void *> params;
+		for(auto param : to_vector<koopa_raw_value_t>(blk->params)) {
+			if(!live.contains(param)) {
+				removed++;
+				continue;
+			}
+			mut(param)->kind.data.block_arg_ref.index = params.size();
+			params.push_back(param);
+		}
+		if(params.size() != blk->params.len) mut(blk)->params = make_slice(params, KOOPA_RSIK_VALUE);
+	}
+	return removed;
+}
+
+int type_size(koopa_raw_type_t ty) {
+	switch(ty->tag) {
+	case KOOPA_RTT_ARRAY:
+		return ty->data.array.len * type_size(ty->data.array.base);
+	case KOOPA_RTT_UNIT:
+		return 0;
+	default:
+		return 4;
+	}
+}
+
+Cfg::Cfg(koopa_raw_function_t func) {
+	if(func->bbs.len == 0) return;
+	std::vector<koopa_raw_basic_block_t> post;
+	// iterative dfs, the entry block is the first one. Successors are taken
+	// last first so that a branch target follows its block when it can.
+	std::vector<std::pair<koopa_raw_basic_block_t, size_t>> stk;
+	auto entry = (koopa_raw_basic_block_t)func->bbs.buffer[0];
+	succs[entry] = get_successors(entry);
+	stk.push_back({entry, 0});
+	while(!stk.empty()) {
+		auto &[blk, i] = stk.back();
+		if(i < succs[blk].size()) {
+			auto nxt = succs[blk][succs[blk].size() - 1 - i];
+			i++;
+			if(!succs.contains(nxt)) {
+				succs[nxt] = get_successors(nxt);
+				stk.push_back({nxt, 0});
+			}
+		} else {
+			post.push_back(blk);
+			stk.pop_back();
+		}
+	}
+	rpo.assign(post.rbegin(), post.rend());
+	for(auto blk : rpo) {
+		preds[blk];
+		for(auto nxt : succs[blk]) {
+			preds[nxt].push_back(blk);
+		}
+	}
+}
+
+Dom_tree::Dom_tree(const Cfg &cfg) {
+	if(cfg.rpo.empty()) return;
+	// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+	std::unordered_map<koopa_raw_basic_block_t, int> order;
+	for(size_t i = 0; i < cfg.rpo.size(); i++) {
+		order[cfg.rpo[i]] = i;
+	}
+	auto entry = cfg.rpo.front();
+	idom[entry] = entry;
+	auto intersect = [&](koopa_raw_basic_block_t a, koopa_raw_basic_block_t b) {
+		while(a != b) {
+			while(order[a] > order[b]) a = idom[a];
+			while(order[b] > order[a]) b = idom[b];
+		}
+		return a;
+	};
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(size_t i = 1; i < cfg.rpo.size(); i++) {
+			auto blk = cfg.rpo[i];
+			koopa_raw_basic_block_t now = nullptr;
+			for(auto pred : cfg.preds.at(blk)) {
+				if(!idom.contains(pred)) continue;
+				now = now == nullptr ? pred : intersect(pred, now);
+			}
+			if(idom[blk] != now) {
+				idom[blk] = now;
+				changed = true;
+			}
+		}
+	}
+	for(auto blk : cfg.rpo) {
+		children[blk];
+		frontier[blk];
+		if(blk != entry) children[idom[blk]].push_back(blk);
+	}
+	for(auto blk : cfg.rpo) {
+		auto &preds = cfg.preds.at(blk);
+		if(preds.size() < 2) continue;
+		for(auto pred : preds) {
+			for(auto run = pred; run != idom[blk]; run = idom[run]) {
+				auto &df = frontier[run];
+				if(df.empty() || df.back() != blk) df.push_back(blk);
+			}
+		}
+	}
+}
+
+bool Dom_tree::dominates(koopa_raw_basic_block_t a, koopa_raw_basic_block_t b) const {
+	while(true) {
+		if(a == b) return true;
+		auto up = idom.at(b);
+		if(up == b) return false;
+		b = up;
+	}
+}
+
+void order_blocks(koopa_raw_function_t func) {
+	Cfg cfg(func);
+	set_blocks(func, cfg.rpo);
+}
+
+void report(const std::string &pass, koopa_raw_function_t func, const std::string &msg) {
+	if(Options::opt_report) {
+		std::cerr << pass << ": " << func->name << " " << msg << "\n";
+	}
+}
+
+void optimize_ir(koopa_raw_program_t &prog) {
+	// whatever the previous program allocated has been lowered already
+	Pool::values.clear();
+	Pool::blocks.clear();
+	Pool::slices.clear();
+	analyze_mod_ref(prog);
+	std::vector<koopa_raw_function_t> funcs;
+	for(auto func : to_vector<koopa_raw_function_t>(prog.funcs)) {
+		if(func->bbs.len > 0) funcs.push_back(func);
+	}
+	for(auto func : funcs) {
+		order_blocks(func);
+		int promoted = promote_allocs(func);
+		report("mem2reg", func, std::to_string(promoted) + " allocs promoted");
+		simplify_cfg(func);
+	}
+	// callees are inlined in their SSA form
+	inline_calls(prog);
+	for(auto func : funcs) {
+		int tail = eliminate_tail_recursion(func);
+		report("tail-rec", func, std::to_string(tail) + " calls turned into jumps");
+		int globals = promote_globals(func);
+		report("globals", func, std::to_string(globals) + " globals kept local in loops");
+		// equal addresses let load-elim match more loads, whose results may
+		// in turn make more expressions equal
+		int values = number_values(func);
+		int loads = eliminate_redundant_loads(func);
+		report("load-elim", func, std::to_string(loads) + " loads removed");
+		values += number_values(func);
+		report("gvn", func, std::to_string(values) + " values removed");
+		int hoisted = hoist_invariants(func);
+		report("licm", func, std::to_string(hoisted) + " instructions hoisted");
+		// a loop overwriting an array whole is told before unrolling splits it
+		int stores = eliminate_dead_stores(func);
+		// the copies are folded as they are made, what they share is numbered here
+		if(unroll_loops(func) > 0) number_values(func);
+		int reduced = reduce_induction_vars(func);
+		report("iv", func, std::to_string(reduced) + " addresses carried across trips");
+		stores += eliminate_dead_stores(func);
+		report("dead-store", func, std::to_string(stores) + " stores removed");
+		remove_dead_values(func);
+		// drops the preheaders nothing was hoisted to
+		simplify_cfg(func);
+	}
+}
+
+}   // namespace Koopa_Opt
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "koopa.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Optimizations on the raw program built by libkoopa. Passes edit the raw
+// structures in place; new values, blocks and slices live in pools owned here.
+namespace Koopa_Opt {
+
+void optimize_ir(koopa_raw_program_t &prog);
+
+// ---- raw program helpers (opt.cpp) ----
+
+koopa_raw_value_data_t *mut(koopa_raw_value_t val);
+koopa_raw_basic_block_data_t *mut(koopa_raw_basic_block_t blk);
+koopa_raw_function_data_t *mut(koopa_raw_function_t func);
+
+koopa_raw_type_t int_type();
+koopa_raw_type_t unit_type();
+koopa_raw_value_data_t *new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag);
+koopa_raw_value_t new_integer(int x);
+koopa_raw_basic_block_data_t *new_block(const char *name);
+
+koopa_raw_slice_t make_slice(const std::vector<const void *> &items, koopa_raw_slice_item_kind_t kind);
+
+template<typename T>
+std::vector<T> to_vector(const koopa_raw_slice_t &slice) {
+	std::vector<T> ret;
+	for(size_t i = 0; i < slice.len; i++) {
+		ret.push_back((T)slice.buffer[i]);
+	}
+	return ret;
+}
+
+std::vector<koopa_raw_basic_block_t> get_blocks(koopa_raw_function_t func);
+std::vector<koopa_raw_value_t> get_insts(koopa_raw_basic_block_t blk);
+void set_blocks(koopa_raw_function_t func, const std::vector<koopa_raw_basic_block_t> &blks);
+void set_insts(koopa_raw_basic_block_t blk, const std::vector<koopa_raw_value_t> &insts);
+
+bool is_terminator(koopa_raw_value_t val);
+koopa_raw_value_t get_terminator(koopa_raw_basic_block_t blk);
+std::vector<koopa_raw_basic_block_t> get_successors(koopa_raw_basic_block_t blk);
+// Points the edges of term that go to from at to, keeping their arguments.
+void retarget(koopa_raw_value_t term, koopa_raw_basic_block_t from, koopa_raw_basic_block_t to);
+// Edge succ of a jump or a branch, the true edge of a branch first.
+int edge_count(koopa_raw_value_t term);
+koopa_raw_basic_block_t &edge_target(koopa_raw_value_t term, int succ);
+koopa_raw_slice_t &edge_args(koopa_raw_value_t term, int succ);
+
+// Calls fn on every value operand of val, by reference so that it can be replaced.
+void for_each_operand(koopa_raw_value_t val, const std::function<void(koopa_raw_value_t &)> &fn);
+void replace_uses(koopa_raw_function_t func, const std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> &replace);
+bool has_side_effect(koopa_raw_value_t val);
+// Removes instructions without side effects and block parameters whose values
+// nothing with a side effect needs, counters feeding only themselves included.
+int remove_dead_values(koopa_raw_function_t func);
+
+int type_size(koopa_raw_type_t ty);
+
+class Cfg {
+public:
+	std::vector<koopa_raw_basic_block_t> rpo;   // reachable blocks in reverse post order
+	std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> preds;
+	std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> succs;
+	Cfg(koopa_raw_function_t func);
+	bool reachable(koopa_raw_basic_block_t blk) const { return succs.contains(blk); }
+};
+
+class Dom_tree {
+public:
+	std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> idom;   // the entry is its own idom
+	std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> children;
+	std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> frontier;
+	Dom_tree(const Cfg &cfg);
+	bool dominates(koopa_raw_basic_block_t a, koopa_raw_basic_block_t b) const;
+};
+
+// Puts the blocks in reverse post order and drops the unreachable ones.
+void order_blocks(koopa_raw_function_t func);
+
+// The constant every edge into blk passes for val when it is a parameter of blk.
+koopa_raw_value_t constant_through(koopa_raw_basic_block_t blk, koopa_raw_value_t val, const Cfg &cfg);
+
+// b op a for a op b, and the comparison that holds when op does not.
+koopa_raw_binary_op_t swap_sides(koopa_raw_binary_op_t op);
+koopa_raw_binary_op_t negate(koopa_raw_binary_op_t op);
+bool holds(koopa_raw_binary_op_t op, int32_t a, int32_t b);
+
+// Prints "pass: @func msg" on stderr under -fopt-report.
+void report(const std::string &pass, koopa_raw_function_t func, const std::string &msg);
+
+// ---- memory locations and mod/ref (opt_modref.cpp) ----
+
+// An access is described by the object it points into and the byte offset
+// inside that object. The object is an alloc, a global alloc, a pointer
+// parameter (its func_arg_ref), or nullptr when it can not be told.
+class Mem_loc {
+public:
+	koopa_raw_value_t base = nullptr;
+	bool known_offset = false;
+	int offset = 0;
+	bool operator==(const Mem_loc &) const = default;
+};
+
+bool may_alias(const Mem_loc &a, const Mem_loc &b);
+
+class Alias_info {
+private:
+	std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> ptr_slot_src;
+	std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> param_base;   // pointer block parameters, nullptr if mixed
+	std::unordered_map<koopa_raw_value_t, Mem_loc> cache;
+
+public:
+	Alias_info(koopa_raw_function_t func);
+	Mem_loc locate(koopa_raw_value_t ptr);
+	bool call_may_mod(koopa_raw_value_t call, const Mem_loc &loc);
+	bool call_may_ref(koopa_raw_value_t call, const Mem_loc &loc);
+};
+
+// Memory a function may touch that is visible to its callers.
+class Mod_ref {
+public:
+	std::unordered_set<koopa_raw_value_t> mod_globals, ref_globals;
+	std::vector<bool> mod_params, ref_params;
+	bool mod_unknown = false, ref_unknown = false;
+	bool operator==(const Mod_ref &) const = default;
+};
+
+void analyze_mod_ref(const koopa_raw_program_t &prog);
+const Mod_ref &get_mod_ref(koopa_raw_function_t func);
+// Globals an earlier program of a stream found its function named to touch,
+// a later program needs them declared to keep the summary precise.
+std::vector<std::string> saved_mod_ref_globals(const std::string &func);
+
+// ---- natural loops (opt_loops.cpp) ----
+
+class Loop {
+public:
+	koopa_raw_basic_block_t header;
+	koopa_raw_basic_block_t preheader = nullptr;   // the only block entering from outside, if there is one
+	std::unordered_set<koopa_raw_basic_block_t> blocks;
+	std::vector<koopa_raw_basic_block_t> latches;   // blocks with a back edge to the header
+	Loop *parent = nullptr;
+	int depth = 1;
+	bool contains(koopa_raw_basic_block_t blk) const { return blocks.contains(blk); }
+};
+
+class Loop_info {
+public:
+	std::vector<std::unique_ptr<Loop>> loops;   // inner loops before the loops around them
+	std::unordered_map<koopa_raw_basic_block_t, Loop *> innermost;
+	Loop_info(const Cfg &cfg, const Dom_tree &dom);
+	int depth(koopa_raw_basic_block_t blk) const;
+};
+
+// Gives every loop a preheader: a block that only jumps to the header and is
+// its only predecessor from outside the loop. Returns how many were added.
+int insert_preheaders(koopa_raw_function_t func);
+
+// ---- induction variables (opt_iv.cpp) ----
+
+// Trips of a loop with a preheader and one latch that is left only from its
+// header, where a parameter stepped by a constant is compared with a constant
+// after starting from one. -1 if it can not be told or the parameter wraps.
+int64_t constant_trips(const Loop &loop, const Cfg &cfg);
+// Allocs and globals such a loop stores to whole, slice after slice, while
+// nothing in it may read them: what they held before is never read again.
+std::vector<koopa_raw_value_t> overwritten_objects(const Loop &loop, const Cfg &cfg, const Dom_tree &dom, const Loop_info &info,
+												   Alias_info &alias);
+
+// Both operands constant: the result, computed with RV32 wrap-around (opt_gvn.cpp).
+bool fold(const koopa_raw_binary_t &bin, int32_t &ret);
+
+// ---- passes, each returns how many instructions it changed ----
+
+int inline_calls(koopa_raw_program_t &prog);               // opt_inline.cpp, on the whole program
+
+int promote_allocs(koopa_raw_function_t func);              // opt_mem2reg.cpp
+int simplify_cfg(koopa_raw_function_t func);                // opt_simplify_cfg.cpp
+int eliminate_tail_recursion(koopa_raw_function_t func);    // opt_tail_rec.cpp
+int promote_globals(koopa_raw_function_t func);             // opt_globals.cpp, returns how many globals
+int number_values(koopa_raw_function_t func);               // opt_gvn.cpp
+int eliminate_redundant_loads(koopa_raw_function_t func);   // opt_load_elim.cpp
+int hoist_invariants(koopa_raw_function_t func);            // opt_licm.cpp
+int unroll_loops(koopa_raw_function_t func);                // opt_unroll.cpp, returns how many loops
+int reduce_induction_vars(koopa_raw_function_t func);       // opt_iv.cpp, returns how many addresses
+int eliminate_dead_stores(koopa_raw_function_t func);       // opt_dead_store.cpp
+
+}   // namespace Koopa_Opt
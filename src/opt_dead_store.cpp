@@ -0,0 +1,207 @@
+#include <set>
+#include <tuple>
+
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Dead_Store_Defs {
+
+// Locations that may be read later. A location with an unknown offset stands
+// for its whole object; unknown is set once something unidentified is read.
+class Live_set {
+public:
+	std::set<std::tuple<koopa_raw_value_t, int, bool>> locs;
+	bool unknown = false;
+
+	void add(const Mem_loc &loc) {
+		if(loc.base == nullptr) {
+			unknown = true;
+		} else {
+			locs.insert({loc.base, loc.known_offset ? loc.offset : 0, loc.known_offset});
+		}
+	}
+	void kill(const Mem_loc &loc) {
+		if(loc.base != nullptr && loc.known_offset) {
+			locs.erase({loc.base, loc.offset, true});
+		}
+	}
+	// Nothing reads what the object held before.
+	void overwrite(koopa_raw_value_t base) {
+		std::erase_if(locs, [&](const auto &loc) { return std::get<0>(loc) == base; });
+	}
+	bool may_read(const Mem_loc &loc) const {
+		if(unknown || loc.base == nullptr) return true;
+		for(auto &[base, offset, known] : locs) {
+			if(may_alias(loc, Mem_loc{base, known, offset})) return true;
+		}
+		return false;
+	}
+	void merge(const Live_set &other) {
+		locs.insert(other.locs.begin(), other.locs.end());
+		unknown |= other.unknown;
+	}
+	bool operator==(const Live_set &) const = default;
+};
+
+// Everything the caller can see stays live after a return.
+Live_set live_at_return(koopa_raw_function_t func) {
+	Live_set ret;
+	for(auto g : get_mod_ref(func).mod_globals) {
+		ret.add(Mem_loc{g, type_size(g->ty->data.pointer.base) == 4, 0});
+	}
+	for(auto param : to_vector<koopa_raw_value_t>(func->params)) {
+		if(param->ty->tag == KOOPA_RTT_POINTER) ret.add(Mem_loc{param});
+	}
+	return ret;
+}
+
+// Walks a block backwards from the set live at its end. When dead is given,
+// stores nobody reads are collected there.
+void transfer(koopa_raw_basic_block_t blk, Live_set &live, Alias_info &alias, const Live_set &at_return,
+			  std::unordered_set<koopa_raw_value_t> *dead) {
+	auto insts = get_insts(blk);
+	for(auto it = insts.rbegin(); it != insts.rend(); ++it) {
+		auto inst = *it;
+		const auto &kind = inst->kind;
+		switch(kind.tag) {
+		case KOOPA_RVT_RETURN:
+			live = at_return;
+			break;
+		case KOOPA_RVT_LOAD:
+			live.add(alias.locate(kind.data.load.src));
+			break;
+		case KOOPA_RVT_STORE: {
+			auto loc = alias.locate(kind.data.store.dest);
+			if(dead != nullptr && !live.may_read(loc)) {
+				dead->insert(inst);
+			}
+			live.kill(loc);
+			break;
+		}
+		case KOOPA_RVT_CALL: {
+			auto &callee = get_mod_ref(kind.data.call.callee);
+			live.unknown |= callee.ref_unknown;
+			for(auto g : callee.ref_globals) {
+				live.add(Mem_loc{g});
+			}
+			for(size_t i = 0; i < callee.ref_params.size(); i++) {
+				if(callee.ref_params[i]) {
+					live.add(Mem_loc{alias.locate((koopa_raw_value_t)kind.data.call.args.buffer[i]).base});
+				}
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+// A loop left with nothing to do but count to a constant is jumped over.
+int skip_empty_loops(koopa_raw_function_t func) {
+	int skipped = 0;
+	for(bool changed = true; changed;) {
+		changed = false;
+		Cfg cfg(func);
+		Dom_tree dom(cfg);
+		Loop_info info(cfg, dom);
+		for(auto &loop : info.loops) {
+			if(constant_trips(*loop, cfg) < 0) continue;
+			std::unordered_set<koopa_raw_value_t> defined;
+			bool busy = false;
+			for(auto blk : loop->blocks) {
+				for(auto param : to_vector<koopa_raw_value_t>(blk->params)) {
+					defined.insert(param);
+				}
+				for(auto inst : get_insts(blk)) {
+					defined.insert(inst);
+					busy |= !is_terminator(inst) && has_side_effect(inst);
+				}
+			}
+			auto test = get_terminator(loop->header);
+			int out = loop->contains(edge_target(test, 0)) ? 1 : 0;
+			// the arguments of the exit edge are the same from the preheader
+			for(auto arg : to_vector<koopa_raw_value_t>(edge_args(test, out))) {
+				busy |= defined.contains(arg);
+			}
+			if(busy) continue;
+			for(auto blk : cfg.rpo) {
+				if(loop->contains(blk)) continue;
+				for(auto inst : get_insts(blk)) {
+					for_each_operand(inst, [&](koopa_raw_value_t &opr) { busy |= defined.contains(opr); });
+				}
+			}
+			if(busy) continue;
+			auto &jump = mut(get_terminator(loop->preheader))->kind.data.jump;
+			jump.target = edge_target(test, out);
+			jump.args = make_slice(to_vector<const void *>(edge_args(test, out)), KOOPA_RSIK_VALUE);
+			order_blocks(func);
+			skipped++;
+			changed = true;
+			break;
+		}
+	}
+	return skipped;
+}
+
+}   // namespace Dead_Store_Defs
+
+using namespace Dead_Store_Defs;
+
+int eliminate_dead_stores(koopa_raw_function_t func) {
+	insert_preheaders(func);
+	Cfg cfg(func);
+	Dom_tree dom(cfg);
+	Loop_info info(cfg, dom);
+	Alias_info alias(func);
+	Live_set at_return = live_at_return(func);
+	// what a loop overwrites whole is dead where it is entered
+	std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_value_t>> overwritten;
+	for(auto &loop : info.loops) {
+		if(loop->preheader != nullptr) overwritten[loop->preheader] = overwritten_objects(*loop, cfg, dom, info, alias);
+	}
+	std::unordered_map<koopa_raw_basic_block_t, Live_set> live_in;
+	auto get_out = [&](koopa_raw_basic_block_t blk) {
+		Live_set out;
+		for(auto succ : cfg.succs[blk]) {
+			out.merge(live_in[succ]);
+		}
+		if(auto it = overwritten.find(blk); it != overwritten.end()) {
+			for(auto base : it->second) {
+				out.overwrite(base);
+			}
+		}
+		return out;
+	};
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(auto it = cfg.rpo.rbegin(); it != cfg.rpo.rend(); ++it) {
+			Live_set now = get_out(*it);
+			transfer(*it, now, alias, at_return, nullptr);
+			if(!(live_in[*it] == now)) {
+				live_in[*it] = std::move(now);
+				changed = true;
+			}
+		}
+	}
+	std::unordered_set<koopa_raw_value_t> dead;
+	for(auto blk : cfg.rpo) {
+		Live_set now = get_out(blk);
+		transfer(blk, now, alias, at_return, &dead);
+	}
+	for(auto blk : cfg.rpo) {
+		std::vector<koopa_raw_value_t> insts;
+		for(auto inst : get_insts(blk)) {
+			if(!dead.contains(inst)) insts.push_back(inst);
+		}
+		set_insts(blk, insts);
+	}
+	if(!dead.empty()) {
+		int skipped = skip_empty_loops(func);
+		if(skipped > 0) report("dead-store", func, std::to_string(skipped) + " emptied loops skipped");
+	}
+	return dead.size();
+}
+
+}   // namespace Koopa_Opt
@@ -0,0 +1,161 @@
+#include <algorithm>
+
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Globals_Defs {
+
+bool is_scalar_global(koopa_raw_value_t val) {
+	return val->kind.tag == KOOPA_RVT_GLOBAL_ALLOC && val->ty->data.pointer.base->tag == KOOPA_RTT_INT32;
+}
+
+// The scalar globals a loop only loads and stores, in the order they are first
+// met, each with whether it stores.
+std::vector<std::pair<koopa_raw_value_t, bool>> accessed_globals(const Loop &loop, const Cfg &cfg) {
+	std::vector<std::pair<koopa_raw_value_t, bool>> ret;
+	std::unordered_map<koopa_raw_value_t, size_t> index;
+	std::unordered_set<koopa_raw_value_t> escaped;
+	for(auto blk : cfg.rpo) {
+		if(!loop.contains(blk)) continue;
+		for(auto inst : get_insts(blk)) {
+			auto &kind = mut(inst)->kind;
+			for_each_operand(inst, [&](koopa_raw_value_t &opr) {
+				if(!is_scalar_global(opr)) return;
+				bool load = kind.tag == KOOPA_RVT_LOAD && &opr == &kind.data.load.src;
+				bool store = kind.tag == KOOPA_RVT_STORE && &opr == &kind.data.store.dest;
+				if(!load && !store) escaped.insert(opr);
+				if(!index.contains(opr)) {
+					index[opr] = ret.size();
+					ret.push_back({opr, false});
+				}
+				ret[index[opr]].second |= store;
+			});
+		}
+	}
+	std::erase_if(ret, [&](auto &item) { return escaped.contains(item.first); });
+	return ret;
+}
+
+bool stores_global(const Loop &loop, const Cfg &cfg) {
+	auto globals = accessed_globals(loop, cfg);
+	return std::any_of(globals.begin(), globals.end(), [](auto &item) { return item.second; });
+}
+
+// Splits one edge from a loop that writes globals to an exit also entered
+// from elsewhere, so the write back has a block of its own. False when none is left.
+bool split_exit(koopa_raw_function_t func) {
+	Cfg cfg(func);
+	Dom_tree dom(cfg);
+	Loop_info info(cfg, dom);
+	for(auto &loop : info.loops) {
+		if(!stores_global(*loop, cfg)) continue;
+		for(auto blk : cfg.rpo) {
+			if(!loop->contains(blk)) continue;
+			for(auto exit : cfg.succs.at(blk)) {
+				if(loop->contains(exit)) continue;
+				auto &preds = cfg.preds.at(exit);
+				if(std::all_of(preds.begin(), preds.end(), [&](auto pred) { return loop->contains(pred); })) continue;
+				auto split = new_block("%loop_exit");
+				std::vector<const void *> params;
+				for(auto param : to_vector<koopa_raw_value_t>(exit->params)) {
+					auto now = new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF);
+					now->kind.data.block_arg_ref.index = params.size();
+					params.push_back(now);
+				}
+				split->params = make_slice(params, KOOPA_RSIK_VALUE);
+				auto jump = new_value(unit_type(), KOOPA_RVT_JUMP);
+				jump->kind.data.jump.target = exit;
+				jump->kind.data.jump.args = make_slice(params, KOOPA_RSIK_VALUE);
+				set_insts(split, {jump});
+				for(auto pred : preds) {
+					if(loop->contains(pred)) retarget(get_terminator(pred), exit, split);
+				}
+				order_blocks(func);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Copies the integer at one pointer to another before insts[at].
+void copy_at(std::vector<koopa_raw_value_t> &insts, size_t at, koopa_raw_value_t from, koopa_raw_value_t to) {
+	auto load = new_value(int_type(), KOOPA_RVT_LOAD);
+	load->kind.data.load.src = from;
+	auto store = new_value(unit_type(), KOOPA_RVT_STORE);
+	store->kind.data.store = {load, to};
+	insts.insert(insts.begin() + at, {load, store});
+}
+
+// The loop works on a local copy of global instead, read in the preheader. If
+// the loop stores it, it is written back before calls that may read it and in
+// every exit, all of which only the loop enters.
+void promote(const Loop &loop, koopa_raw_value_t global, bool stored, const Cfg &cfg, Alias_info &alias) {
+	auto loc = alias.locate(global);
+	auto local = new_value(global->ty, KOOPA_RVT_ALLOC);
+	auto pre_insts = get_insts(loop.preheader);
+	pre_insts.insert(pre_insts.begin(), local);
+	copy_at(pre_insts, pre_insts.size() - 1, global, local);
+	set_insts(loop.preheader, pre_insts);
+	std::unordered_set<koopa_raw_basic_block_t> exits;
+	for(auto blk : loop.blocks) {
+		auto insts = get_insts(blk);
+		for(size_t i = 0; i < insts.size(); i++) {
+			auto &kind = mut(insts[i])->kind;
+			if(kind.tag == KOOPA_RVT_LOAD && kind.data.load.src == global) kind.data.load.src = local;
+			if(kind.tag == KOOPA_RVT_STORE && kind.data.store.dest == global) kind.data.store.dest = local;
+			if(stored && kind.tag == KOOPA_RVT_CALL && alias.call_may_ref(insts[i], loc)) {
+				copy_at(insts, i, local, global);
+				i += 2;
+			}
+		}
+		set_insts(blk, insts);
+		for(auto succ : cfg.succs.at(blk)) {
+			if(!loop.contains(succ)) exits.insert(succ);
+		}
+	}
+	if(!stored) return;
+	for(auto exit : exits) {
+		auto insts = get_insts(exit);
+		copy_at(insts, 0, local, global);
+		set_insts(exit, insts);
+	}
+}
+
+}   // namespace Globals_Defs
+
+using namespace Globals_Defs;
+
+int promote_globals(koopa_raw_function_t func) {
+	insert_preheaders(func);
+	while(split_exit(func)) {}
+	Cfg cfg(func);
+	Dom_tree dom(cfg);
+	Loop_info info(cfg, dom);
+	Alias_info alias(func);
+	// outer loops first, a global they keep is no longer accessed in the loops inside
+	int promoted = 0;
+	for(auto it = info.loops.rbegin(); it != info.loops.rend(); it++) {
+		auto &loop = **it;
+		if(loop.preheader == nullptr) continue;
+		for(auto &[global, stored] : accessed_globals(loop, cfg)) {
+			// a call that may write it leaves it to the loops between the calls
+			auto loc = alias.locate(global);
+			bool clobbered = false;
+			for(auto blk : loop.blocks) {
+				for(auto inst : get_insts(blk)) {
+					clobbered |= inst->kind.tag == KOOPA_RVT_CALL && alias.call_may_mod(inst, loc);
+				}
+			}
+			if(clobbered) continue;
+			promote(loop, global, stored, cfg, alias);
+			promoted++;
+		}
+	}
+	// the locals are turned into values like any other
+	if(promoted > 0) promote_allocs(func);
+	return promoted;
+}
+
+}   // namespace Koopa_Opt
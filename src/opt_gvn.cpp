@@ -0,0 +1,166 @@
+#include <cstdint>
+#include <map>
+#include <tuple>
+
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Gvn_Defs {
+
+// Operands are numbered by identity, except constants which are equal by value.
+using Operand_key = std::pair<bool, intptr_t>;
+using Expr_key = std::tuple<int, int, Operand_key, Operand_key>;
+
+Operand_key operand_key(koopa_raw_value_t val) {
+	if(val->kind.tag == KOOPA_RVT_INTEGER) {
+		return {false, val->kind.data.integer.value};
+	}
+	return {true, (intptr_t)val};
+}
+
+bool is_commutative(koopa_raw_binary_op_t op) {
+	switch(op) {
+	case KOOPA_RBO_ADD:
+	case KOOPA_RBO_MUL:
+	case KOOPA_RBO_EQ:
+	case KOOPA_RBO_NOT_EQ:
+	case KOOPA_RBO_AND:
+	case KOOPA_RBO_OR:
+	case KOOPA_RBO_XOR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// The constant c of x + c or x - c, as an addend.
+bool const_addend(const koopa_raw_binary_t &bin, int32_t &ret) {
+	if(bin.op != KOOPA_RBO_ADD && bin.op != KOOPA_RBO_SUB) return false;
+	if(bin.rhs->kind.tag != KOOPA_RVT_INTEGER) return false;
+	uint32_t c = bin.rhs->kind.data.integer.value;
+	ret = bin.op == KOOPA_RBO_ADD ? c : -c;
+	return true;
+}
+
+// (x + c1) + c2 becomes x + (c1 + c2), so that the copies of an unrolled loop
+// step from the counter itself.
+void reassociate(koopa_raw_value_t inst) {
+	auto &bin = mut(inst)->kind.data.binary;
+	int32_t outer, inner;
+	if(!const_addend(bin, outer) || bin.lhs->kind.tag != KOOPA_RVT_BINARY) return;
+	auto &lhs = bin.lhs->kind.data.binary;
+	if(!const_addend(lhs, inner)) return;
+	bin.op = KOOPA_RBO_ADD;
+	bin.rhs = new_integer((uint32_t)outer + (uint32_t)inner);
+	bin.lhs = lhs.lhs;
+}
+
+// Pure instructions are keyed by what they compute, others are not numbered.
+bool expr_key(koopa_raw_value_t inst, Expr_key &key) {
+	const auto &kind = inst->kind;
+	switch(kind.tag) {
+	case KOOPA_RVT_BINARY: {
+		auto lhs = operand_key(kind.data.binary.lhs), rhs = operand_key(kind.data.binary.rhs);
+		if(is_commutative(kind.data.binary.op) && rhs < lhs) std::swap(lhs, rhs);
+		key = {kind.tag, kind.data.binary.op, lhs, rhs};
+		return true;
+	}
+	case KOOPA_RVT_GET_PTR:
+	case KOOPA_RVT_GET_ELEM_PTR:
+		key = {kind.tag, 0, operand_key(kind.data.get_elem_ptr.src), operand_key(kind.data.get_elem_ptr.index)};
+		return true;
+	default:
+		return false;
+	}
+}
+
+}   // namespace Gvn_Defs
+
+using namespace Gvn_Defs;
+
+bool fold(const koopa_raw_binary_t &bin, int32_t &ret) {
+	if(bin.lhs->kind.tag != KOOPA_RVT_INTEGER || bin.rhs->kind.tag != KOOPA_RVT_INTEGER) return false;
+	int32_t a = bin.lhs->kind.data.integer.value, b = bin.rhs->kind.data.integer.value;
+	uint32_t ua = a, ub = b;
+	switch(bin.op) {
+	case KOOPA_RBO_NOT_EQ: ret = a != b; break;
+	case KOOPA_RBO_EQ: ret = a == b; break;
+	case KOOPA_RBO_GT: ret = a > b; break;
+	case KOOPA_RBO_LT: ret = a < b; break;
+	case KOOPA_RBO_GE: ret = a >= b; break;
+	case KOOPA_RBO_LE: ret = a <= b; break;
+	case KOOPA_RBO_ADD: ret = ua + ub; break;
+	case KOOPA_RBO_SUB: ret = ua - ub; break;
+	case KOOPA_RBO_MUL: ret = ua * ub; break;
+	case KOOPA_RBO_DIV:
+	case KOOPA_RBO_MOD:
+		// left to the hardware, whose results for these are well defined
+		if(b == 0 || (a == INT32_MIN && b == -1)) return false;
+		ret = bin.op == KOOPA_RBO_DIV ? a / b : a % b;
+		break;
+	case KOOPA_RBO_AND: ret = a & b; break;
+	case KOOPA_RBO_OR: ret = a | b; break;
+	case KOOPA_RBO_XOR: ret = a ^ b; break;
+	case KOOPA_RBO_SHL: ret = ua << (ub & 31); break;
+	case KOOPA_RBO_SHR: ret = ua >> (ub & 31); break;
+	case KOOPA_RBO_SAR: ret = a >> (ub & 31); break;
+	default: return false;
+	}
+	return true;
+}
+
+int number_values(koopa_raw_function_t func) {
+	Cfg cfg(func);
+	Dom_tree dom(cfg);
+	std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+	// a value is available in the blocks its own block dominates, so the table
+	// is scoped along the dominator tree with an undo log
+	std::map<Expr_key, koopa_raw_value_t> table;
+	std::vector<Expr_key> log;
+	std::vector<std::tuple<koopa_raw_basic_block_t, size_t, size_t>> stk;
+	stk.push_back({cfg.rpo.front(), 0, 0});
+	while(!stk.empty()) {
+		auto &[blk, child, log_size] = stk.back();
+		if(child == 0) {
+			log_size = log.size();
+			std::vector<koopa_raw_value_t> insts;
+			for(auto inst : get_insts(blk)) {
+				for_each_operand(inst, [&](koopa_raw_value_t &opr) {
+					if(auto it = replace.find(opr); it != replace.end()) opr = it->second;
+				});
+				Expr_key key;
+				int32_t folded;
+				if(inst->kind.tag == KOOPA_RVT_BINARY) reassociate(inst);
+				if(inst->kind.tag == KOOPA_RVT_BINARY && fold(inst->kind.data.binary, folded)) {
+					replace[inst] = new_integer(folded);
+				} else if(!expr_key(inst, key)) {
+					insts.push_back(inst);
+				} else if(auto it = table.find(key); it != table.end()) {
+					replace[inst] = it->second;
+				} else {
+					table[key] = inst;
+					log.push_back(key);
+					insts.push_back(inst);
+				}
+			}
+			set_insts(blk, insts);
+		}
+		auto &kids = dom.children.at(blk);
+		if(child < kids.size()) {
+			auto nxt = kids[child];
+			child++;
+			stk.push_back({nxt, 0, 0});
+			continue;
+		}
+		while(log.size() > log_size) {
+			table.erase(log.back());
+			log.pop_back();
+		}
+		stk.pop_back();
+	}
+	replace_uses(func, replace);
+	return replace.size();
+}
+
+}   // namespace Koopa_Opt
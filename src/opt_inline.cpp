@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <iostream>
+
+#include "opt.hpp"
+#include "options.hpp"
+
+namespace Koopa_Opt {
+
+namespace Inline_Defs {
+
+const int max_caller_size = 4000;   // stop growing a function past this many instructions
+
+int func_size(koopa_raw_function_t func) {
+	int ret = 0;
+	for(auto blk : get_blocks(func)) {
+		ret += blk->insts.len;
+	}
+	return ret;
+}
+
+// Strongly connected components of the call graph among functions with a
+// body, callees before callers (Tarjan).
+class Call_graph {
+public:
+	std::unordered_map<koopa_raw_function_t, std::vector<koopa_raw_function_t>> callees;
+	std::unordered_map<koopa_raw_function_t, int> scc_of;
+	std::vector<koopa_raw_function_t> bottom_up;
+
+	Call_graph(const std::vector<koopa_raw_function_t> &funcs) {
+		for(auto func : funcs) {
+			auto &list = callees[func];
+			for(auto blk : get_blocks(func)) {
+				for(auto inst : get_insts(blk)) {
+					if(inst->kind.tag != KOOPA_RVT_CALL) continue;
+					auto callee = inst->kind.data.call.callee;
+					if(callee->bbs.len > 0) list.push_back(callee);
+				}
+			}
+		}
+		for(auto func : funcs) {
+			if(!index.contains(func)) connect(func);
+		}
+	}
+
+private:
+	std::unordered_map<koopa_raw_function_t, int> index, low;
+	std::vector<koopa_raw_function_t> stk;
+	std::unordered_set<koopa_raw_function_t> on_stack;
+	int counter = 0, scc_count = 0;
+
+	void connect(koopa_raw_function_t func) {
+		index[func] = low[func] = counter++;
+		stk.push_back(func);
+		on_stack.insert(func);
+		for(auto callee : callees[func]) {
+			if(!index.contains(callee)) {
+				connect(callee);
+				low[func] = std::min(low[func], low[callee]);
+			} else if(on_stack.contains(callee)) {
+				low[func] = std::min(low[func], index[callee]);
+			}
+		}
+		if(low[func] != index[func]) return;
+		while(true) {
+			auto top = stk.back();
+			stk.pop_back();
+			on_stack.erase(top);
+			scc_of[top] = scc_count;
+			bottom_up.push_back(top);
+			if(top == func) break;
+		}
+		scc_count++;
+	}
+};
+
+// Copies the body of callee in place of call, which sits in blk of caller.
+void inline_call(koopa_raw_function_t caller, koopa_raw_basic_block_t blk, koopa_raw_value_t call) {
+	auto callee = call->kind.data.call.callee;
+	std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> vals;
+	std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> blks;
+	auto args = to_vector<koopa_raw_value_t>(call->kind.data.call.args);
+	for(size_t i = 0; i < args.size(); i++) {
+		vals[(koopa_raw_value_t)callee->params.buffer[i]] = args[i];
+	}
+	// the rest of blk continues after the call, taking the result as a parameter
+	auto insts = get_insts(blk);
+	auto pos = std::find(insts.begin(), insts.end(), call);
+	auto tail = new_block(blk->name);
+	koopa_raw_value_t result = nullptr;
+	if(call->ty->tag != KOOPA_RTT_UNIT) {
+		auto param = new_value(call->ty, KOOPA_RVT_BLOCK_ARG_REF);
+		param->kind.data.block_arg_ref.index = 0;
+		tail->params = make_slice({param}, KOOPA_RSIK_VALUE);
+		result = param;
+	}
+	set_insts(tail, std::vector<koopa_raw_value_t>(pos + 1, insts.end()));
+	std::vector<koopa_raw_basic_block_t> body;
+	for(auto old : get_blocks(callee)) {
+		auto now = new_block(old->name);
+		std::vector<const void *> params;
+		for(auto param : to_vector<koopa_raw_value_t>(old->params)) {
+			auto copy = new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF);
+			copy->kind = param->kind;
+			vals[param] = copy;
+			params.push_back(copy);
+		}
+		now->params = make_slice(params, KOOPA_RSIK_VALUE);
+		blks[old] = now;
+		body.push_back(now);
+	}
+	auto copy_slice = [](koopa_raw_slice_t &slice) { slice = make_slice(to_vector<const void *>(slice), slice.kind); };
+	for(auto old : get_blocks(callee)) {
+		std::vector<koopa_raw_value_t> copies;
+		for(auto inst : get_insts(old)) {
+			koopa_raw_value_data_t *copy;
+			if(inst->kind.tag == KOOPA_RVT_RETURN) {
+				copy = new_value(unit_type(), KOOPA_RVT_JUMP);
+				copy->kind.data.jump.target = tail;
+				auto ret = inst->kind.data.ret.value;
+				if(result != nullptr && ret == nullptr) ret = new_value(call->ty, KOOPA_RVT_UNDEF);
+				copy->kind.data.jump.args = make_slice(result != nullptr ? std::vector<const void *>{ret} : std::vector<const void *>{},
+													   KOOPA_RSIK_VALUE);
+			} else {
+				copy = new_value(inst->ty, inst->kind.tag);
+				copy->kind = inst->kind;
+				auto &kind = copy->kind;
+				switch(kind.tag) {
+				case KOOPA_RVT_BRANCH:
+					kind.data.branch.true_bb = blks[kind.data.branch.true_bb];
+					kind.data.branch.false_bb = blks[kind.data.branch.false_bb];
+					copy_slice(kind.data.branch.true_args);
+					copy_slice(kind.data.branch.false_args);
+					break;
+				case KOOPA_RVT_JUMP:
+					kind.data.jump.target = blks[kind.data.jump.target];
+					copy_slice(kind.data.jump.args);
+					break;
+				case KOOPA_RVT_CALL:
+					copy_slice(kind.data.call.args);
+					break;
+				default:
+					break;
+				}
+			}
+			vals[inst] = copy;
+			copies.push_back(copy);
+		}
+		set_insts(blks[old], copies);
+	}
+	// operands are mapped once every copy exists, a block argument may name a later value
+	for(auto now : body) {
+		for(auto inst : get_insts(now)) {
+			for_each_operand(inst, [&](koopa_raw_value_t &opr) {
+				if(auto it = vals.find(opr); it != vals.end()) opr = it->second;
+			});
+		}
+	}
+	auto jump = new_value(unit_type(), KOOPA_RVT_JUMP);
+	jump->kind.data.jump.target = body.front();
+	jump->kind.data.jump.args = make_slice({}, KOOPA_RSIK_VALUE);
+	std::vector<koopa_raw_value_t> head(insts.begin(), pos);
+	head.push_back(jump);
+	set_insts(blk, head);
+	auto all = get_blocks(caller);
+	auto at = std::find(all.begin(), all.end(), blk) + 1;
+	at = all.insert(at, body.begin(), body.end()) + body.size();
+	all.insert(at, tail);
+	set_blocks(caller, all);
+	if(result != nullptr) replace_uses(caller, {{call, result}});
+}
+
+// Inlines the calls of one function that are worth it, by the size of the
+// callee against a budget that grows with loop depth and constant arguments.
+int inline_into(koopa_raw_function_t caller, const Call_graph &graph) {
+	class Site {
+	public:
+		koopa_raw_basic_block_t blk;
+		koopa_raw_value_t call;
+		int depth;
+	};
+	std::vector<Site> sites;
+	{
+		Cfg cfg(caller);
+		Dom_tree dom(cfg);
+		Loop_info loops(cfg, dom);
+		for(auto blk : cfg.rpo) {
+			for(auto inst : get_insts(blk)) {
+				if(inst->kind.tag == KOOPA_RVT_CALL) sites.push_back({blk, inst, loops.depth(blk)});
+			}
+		}
+	}
+	int inlined = 0;
+	int size = func_size(caller);
+	for(auto &site : sites) {
+		auto callee = site.call->kind.data.call.callee;
+		if(callee->bbs.len == 0 || graph.scc_of.at(callee) == graph.scc_of.at(caller)) continue;
+		int const_args = 0;
+		for(auto arg : to_vector<koopa_raw_value_t>(site.call->kind.data.call.args)) {
+			const_args += arg->kind.tag == KOOPA_RVT_INTEGER;
+		}
+		// the call sequence itself goes away, constants usually fold away more
+		int callee_size = func_size(callee);
+		int cost = callee_size - 2 * (int)site.call->kind.data.call.args.len - 3 * const_args;
+		int budget = Options::inline_threshold << std::min(site.depth, 3);
+		bool ok = cost <= budget && size + callee_size <= max_caller_size;
+		if(Options::inline_report) {
+			std::cerr << "inline: " << caller->name << " <- " << callee->name << " cost " << cost << ", budget "
+					  << budget << ", depth " << site.depth << (ok ? ", inlined" : ", kept") << "\n";
+		}
+		if(!ok) continue;
+		// earlier inlining may have moved the call into a tail block
+		auto blk = site.blk;
+		for(auto now : get_blocks(caller)) {
+			auto insts = get_insts(now);
+			if(std::find(insts.begin(), insts.end(), site.call) != insts.end()) {
+				blk = now;
+				break;
+			}
+		}
+		inline_call(caller, blk, site.call);
+		size += callee_size;
+		inlined++;
+	}
+	if(inlined > 0) order_blocks(caller);
+	return inlined;
+}
+
+}   // namespace Inline_Defs
+
+using namespace Inline_Defs;
+
+int inline_calls(koopa_raw_program_t &prog) {
+	std::vector<koopa_raw_function_t> funcs;
+	for(auto func : to_vector<koopa_raw_function_t>(prog.funcs)) {
+		if(func->bbs.len > 0) funcs.push_back(func);
+	}
+	if(Options::inline_threshold <= 0) return 0;
+	Call_graph graph(funcs);
+	int total = 0;
+	for(auto func : graph.bottom_up) {
+		int inlined = inline_into(func, graph);
+		report("inline", func, std::to_string(inlined) + " calls inlined");
+		total += inlined;
+	}
+	return total;
+}
+
+}   // namespace Koopa_Opt
@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <set>
+
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Iv_Defs {
+
+// A value of a loop as a sum of values it does not change and of header
+// parameters, each times a constant, plus a constant. Pointers count in bytes.
+// Arithmetic wraps at 32 bits like the addresses on RV32 do.
+class Form {
+public:
+	std::map<koopa_raw_value_t, uint32_t> terms;
+	uint32_t constant = 0;
+
+	void add(const Form &other, uint32_t times) {
+		for(auto &[val, coef] : other.terms) {
+			if((terms[val] += coef * times) == 0) terms.erase(val);
+		}
+		constant += other.constant * times;
+	}
+};
+
+using Maybe_form = std::optional<Form>;
+
+// The step of a header parameter that the back edge advances by a constant.
+std::optional<uint32_t> basic_step(koopa_raw_value_t param, koopa_raw_value_t next) {
+	if(next->kind.tag != KOOPA_RVT_BINARY) return std::nullopt;
+	auto inc = next->kind.data.binary;
+	if(inc.op == KOOPA_RBO_ADD && inc.rhs == param) std::swap(inc.lhs, inc.rhs);
+	if(inc.op != KOOPA_RBO_ADD && inc.op != KOOPA_RBO_SUB) return std::nullopt;
+	if(inc.lhs != param || inc.rhs->kind.tag != KOOPA_RVT_INTEGER) return std::nullopt;
+	uint32_t step = inc.rhs->kind.data.integer.value;
+	return inc.op == KOOPA_RBO_ADD ? step : -step;
+}
+
+Maybe_form binary_form(const koopa_raw_binary_t &bin, const Form &lhs, const Form &rhs) {
+	Form ret = lhs;
+	switch(bin.op) {
+	case KOOPA_RBO_ADD:
+		ret.add(rhs, 1);
+		return ret;
+	case KOOPA_RBO_SUB:
+		ret.add(rhs, -1);
+		return ret;
+	case KOOPA_RBO_MUL:
+		if(rhs.terms.empty()) {
+			ret = Form();
+			ret.add(lhs, rhs.constant);
+			return ret;
+		}
+		if(lhs.terms.empty()) {
+			ret = Form();
+			ret.add(rhs, lhs.constant);
+			return ret;
+		}
+		return std::nullopt;
+	case KOOPA_RBO_SHL:
+		if(!rhs.terms.empty() || rhs.constant >= 32) return std::nullopt;
+		ret = Form();
+		ret.add(lhs, 1u << rhs.constant);
+		return ret;
+	default:
+		return std::nullopt;
+	}
+}
+
+// The forms of the values a loop defines, for the given steps of its header
+// parameters. In reverse post order operands come first.
+class Loop_forms {
+public:
+	std::vector<koopa_raw_basic_block_t> blks;
+	std::unordered_set<koopa_raw_value_t> defined;
+	std::unordered_map<koopa_raw_value_t, Maybe_form> forms;
+	const std::unordered_map<koopa_raw_value_t, uint32_t> &steps;
+
+	Loop_forms(const Loop &loop, const Cfg &cfg, const std::unordered_map<koopa_raw_value_t, uint32_t> &steps) : steps(steps) {
+		for(auto blk : cfg.rpo) {
+			if(!loop.contains(blk)) continue;
+			blks.push_back(blk);
+			for(auto param : to_vector<koopa_raw_value_t>(blk->params)) {
+				defined.insert(param);
+			}
+			for(auto inst : get_insts(blk)) {
+				defined.insert(inst);
+			}
+		}
+		for(auto blk : blks) {
+			for(auto inst : get_insts(blk)) {
+				Maybe_form form;
+				auto &kind = inst->kind;
+				if(kind.tag == KOOPA_RVT_BINARY) {
+					auto lhs = form_of(kind.data.binary.lhs), rhs = form_of(kind.data.binary.rhs);
+					if(lhs && rhs) form = binary_form(kind.data.binary, *lhs, *rhs);
+				} else if(kind.tag == KOOPA_RVT_GET_PTR || kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+					auto src = form_of(kind.data.get_elem_ptr.src), index = form_of(kind.data.get_elem_ptr.index);
+					if(src && index) {
+						form = src;
+						form->add(*index, type_size(inst->ty->data.pointer.base));
+					}
+				}
+				forms[inst] = form;
+			}
+		}
+	}
+
+	Maybe_form form_of(koopa_raw_value_t val) const {
+		Form ret;
+		if(val->kind.tag == KOOPA_RVT_INTEGER) {
+			ret.constant = val->kind.data.integer.value;
+		} else if(!defined.contains(val) || steps.contains(val)) {
+			ret.terms[val] = 1;
+		} else {
+			auto it = forms.find(val);
+			return it == forms.end() ? std::nullopt : it->second;
+		}
+		return ret;
+	}
+};
+
+// Addresses the loop moves by a constant each trip get a pointer parameter of
+// the header instead, started in the preheader and advanced by the latch.
+// Addresses a constant away from one of those are taken from it.
+int reduce(const Loop &loop, const Cfg &cfg) {
+	auto enter = get_terminator(loop.preheader), back = get_terminator(loop.latches.front());
+	if(enter->kind.tag != KOOPA_RVT_JUMP || back->kind.tag != KOOPA_RVT_JUMP) return 0;
+	auto header = loop.header;
+	auto params = to_vector<koopa_raw_value_t>(header->params);
+	auto inits = to_vector<koopa_raw_value_t>(enter->kind.data.jump.args);
+	auto nexts = to_vector<koopa_raw_value_t>(back->kind.data.jump.args);
+	std::unordered_map<koopa_raw_value_t, uint32_t> steps;
+	std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> start;   // values on the first trip
+	for(size_t i = 0; i < params.size(); i++) {
+		if(auto step = basic_step(params[i], nexts[i])) {
+			steps[params[i]] = *step;
+			start[params[i]] = inits[i];
+		}
+	}
+	Loop_forms lf(loop, cfg, steps);
+	auto &blks = lf.blks;
+	auto &defined = lf.defined;
+	auto &forms = lf.forms;
+	auto step_of = [&](koopa_raw_value_t val) {
+		uint32_t ret = 0;
+		for(auto &[term, coef] : forms.at(val)->terms) {
+			if(auto it = steps.find(term); it != steps.end()) ret += coef * it->second;
+		}
+		return ret;
+	};
+	auto moving = [&](koopa_raw_value_t val) {
+		auto tag = val->kind.tag;
+		if(tag != KOOPA_RVT_GET_PTR && tag != KOOPA_RVT_GET_ELEM_PTR) return false;
+		if(!defined.contains(val) || !forms.at(val)) return false;
+		return step_of(val) != 0;
+	};
+	// addresses used other than to make more such addresses
+	std::vector<koopa_raw_value_t> roots;
+	std::unordered_set<koopa_raw_value_t> seen;
+	for(auto blk : blks) {
+		for(auto inst : get_insts(blk)) {
+			if(moving(inst)) continue;
+			for_each_operand(inst, [&](koopa_raw_value_t &opr) {
+				if(moving(opr) && seen.insert(opr).second) roots.push_back(opr);
+			});
+		}
+	}
+	std::vector<koopa_raw_value_t> start_insts;
+	std::function<koopa_raw_value_t(koopa_raw_value_t)> at_start = [&](koopa_raw_value_t val) {
+		if(!defined.contains(val)) return val;
+		if(auto it = start.find(val); it != start.end()) return it->second;
+		auto copy = new_value(val->ty, val->kind.tag);
+		copy->kind = val->kind;
+		for_each_operand(copy, [&](koopa_raw_value_t &opr) { opr = at_start(opr); });
+		start_insts.push_back(copy);
+		start[val] = copy;
+		return (koopa_raw_value_t)copy;
+	};
+	std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+	std::vector<const void *> new_params(params.begin(), params.end());
+	std::vector<const void *> enter_args(inits.begin(), inits.end()), back_args(nexts.begin(), nexts.end());
+	std::vector<koopa_raw_value_t> incs;
+	class Leader {
+	public:
+		koopa_raw_value_t root, param;
+	};
+	std::map<std::pair<koopa_raw_type_t, std::map<koopa_raw_value_t, uint32_t>>, Leader> leaders;
+	std::vector<std::pair<koopa_raw_value_t, Leader>> members;
+	for(auto root : roots) {
+		int elem = type_size(root->ty->data.pointer.base);
+		if(elem == 0) continue;
+		auto &leader = leaders[{root->ty, forms.at(root)->terms}];
+		if(leader.root != nullptr) {
+			members.push_back({root, leader});
+			continue;
+		}
+		int32_t step = step_of(root);
+		if(step % elem != 0) continue;
+		auto param = new_value(root->ty, KOOPA_RVT_BLOCK_ARG_REF);
+		param->kind.data.block_arg_ref.index = new_params.size();
+		new_params.push_back(param);
+		enter_args.push_back(at_start(root));
+		auto inc = new_value(root->ty, KOOPA_RVT_GET_PTR);
+		inc->kind.data.get_ptr = {param, new_integer(step / elem)};
+		incs.push_back(inc);
+		back_args.push_back(inc);
+		replace[root] = param;
+		leader = {root, param};
+	}
+	int reduced = replace.size();
+	// the others turn into a step from their leader where they are, once every
+	// start value is made from the instructions as they were
+	for(auto &[root, leader] : members) {
+		int elem = type_size(root->ty->data.pointer.base);
+		int32_t diff = forms.at(root)->constant - forms.at(leader.root)->constant;
+		if(diff % elem != 0) continue;
+		auto &kind = mut(root)->kind;
+		kind.tag = KOOPA_RVT_GET_PTR;
+		kind.data.get_ptr = {leader.param, new_integer(diff / elem)};
+		reduced++;
+	}
+	if(reduced == 0) return 0;
+	for(auto blk : blks) {
+		for(auto inst : get_insts(blk)) {
+			for_each_operand(inst, [&](koopa_raw_value_t &opr) {
+				if(auto it = replace.find(opr); it != replace.end()) opr = it->second;
+			});
+		}
+	}
+	mut(header)->params = make_slice(new_params, KOOPA_RSIK_VALUE);
+	auto pre_insts = get_insts(loop.preheader);
+	pre_insts.insert(pre_insts.end() - 1, start_insts.begin(), start_insts.end());
+	set_insts(loop.preheader, pre_insts);
+	mut(enter)->kind.data.jump.args = make_slice(enter_args, KOOPA_RSIK_VALUE);
+	auto latch_insts = get_insts(loop.latches.front());
+	latch_insts.insert(latch_insts.end() - 1, incs.begin(), incs.end());
+	set_insts(loop.latches.front(), latch_insts);
+	mut(back)->kind.data.jump.args = make_slice(back_args, KOOPA_RSIK_VALUE);
+	return reduced;
+}
+
+}   // namespace Iv_Defs
+
+using namespace Iv_Defs;
+
+int64_t constant_trips(const Loop &loop, const Cfg &cfg) {
+	if(loop.preheader == nullptr || loop.latches.size() != 1) return -1;
+	auto enter = get_terminator(loop.preheader), back = get_terminator(loop.latches.front());
+	if(enter->kind.tag != KOOPA_RVT_JUMP || back->kind.tag != KOOPA_RVT_JUMP) return -1;
+	for(auto blk : loop.blocks) {
+		if(blk == loop.header) continue;
+		for(auto succ : cfg.succs.at(blk)) {
+			if(!loop.contains(succ)) return -1;
+		}
+	}
+	auto test = get_terminator(loop.header);
+	if(test->kind.tag != KOOPA_RVT_BRANCH) return -1;
+	auto &br = test->kind.data.branch;
+	bool stays = loop.contains(br.true_bb);
+	if(stays == loop.contains(br.false_bb) || br.cond->kind.tag != KOOPA_RVT_BINARY) return -1;
+	auto cmp = br.cond->kind.data.binary;
+	auto params = to_vector<koopa_raw_value_t>(loop.header->params);
+	auto op = cmp.op;
+	auto bound = cmp.rhs;
+	size_t iv = std::find(params.begin(), params.end(), cmp.lhs) - params.begin();
+	if(iv == params.size()) {
+		iv = std::find(params.begin(), params.end(), cmp.rhs) - params.begin();
+		bound = cmp.lhs;
+		op = swap_sides(op);
+	}
+	if(iv == params.size() || bound->kind.tag != KOOPA_RVT_INTEGER) return -1;
+	if(!stays) op = negate(op);
+	auto step = basic_step(params[iv], (koopa_raw_value_t)back->kind.data.jump.args.buffer[iv]);
+	auto init = constant_through(loop.preheader, (koopa_raw_value_t)enter->kind.data.jump.args.buffer[iv], cfg);
+	if(!step || *step == 0 || init->kind.tag != KOOPA_RVT_INTEGER) return -1;
+	int64_t x = init->kind.data.integer.value, n = bound->kind.data.integer.value, s = (int32_t)*step;
+	if(!holds(op, x, n)) return 0;
+	// the last trip steps past n, to no further than one step beyond it
+	switch(op) {
+	case KOOPA_RBO_LE: n++; [[fallthrough]];
+	case KOOPA_RBO_LT:
+		if(s < 0 || n + s - 1 > INT32_MAX) return -1;
+		return (n - x + s - 1) / s;
+	case KOOPA_RBO_GE: n--; [[fallthrough]];
+	case KOOPA_RBO_GT:
+		if(s > 0 || n + s + 1 < INT32_MIN) return -1;
+		return (x - n - s - 1) / -s;
+	case KOOPA_RBO_NOT_EQ:
+		return (n - x) % s == 0 && (n - x) / s > 0 ? (n - x) / s : -1;
+	default:
+		return -1;
+	}
+}
+
+std::vector<koopa_raw_value_t> overwritten_objects(const Loop &loop, const Cfg &cfg, const Dom_tree &dom, const Loop_info &info,
+												   Alias_info &alias) {
+	int64_t trips = constant_trips(loop, cfg);
+	if(trips <= 0) return {};
+	auto enter = get_terminator(loop.preheader), back = get_terminator(loop.latches.front());
+	auto params = to_vector<koopa_raw_value_t>(loop.header->params);
+	std::unordered_map<koopa_raw_value_t, uint32_t> steps;
+	for(size_t i = 0; i < params.size(); i++) {
+		if(auto step = basic_step(params[i], (koopa_raw_value_t)back->kind.data.jump.args.buffer[i])) steps[params[i]] = *step;
+	}
+	// where every parameter in a form starts from, when that is a constant
+	auto start_of = [&](koopa_raw_value_t param) {
+		size_t i = std::find(params.begin(), params.end(), param) - params.begin();
+		return constant_through(loop.preheader, (koopa_raw_value_t)enter->kind.data.jump.args.buffer[i], cfg);
+	};
+	Loop_forms lf(loop, cfg, steps);
+	// the byte step of an object's stores each trip, and where they start
+	class Slices {
+	public:
+		int32_t step = 0;
+		std::set<int64_t> offsets;
+		bool broken = false;
+	};
+	std::map<koopa_raw_value_t, Slices> objects;
+	std::vector<Mem_loc> reads;
+	std::vector<koopa_raw_value_t> calls;
+	for(auto blk : lf.blks) {
+		// the stores made on every trip, once each
+		bool every_trip = blk != loop.header && dom.dominates(blk, loop.latches.front()) && info.innermost.at(blk) == &loop;
+		for(auto inst : get_insts(blk)) {
+			auto &kind = inst->kind;
+			if(kind.tag == KOOPA_RVT_LOAD) reads.push_back(alias.locate(kind.data.load.src));
+			if(kind.tag == KOOPA_RVT_CALL) calls.push_back(inst);
+			if(kind.tag != KOOPA_RVT_STORE || !every_trip) continue;
+			auto dest = kind.data.store.dest;
+			auto form = lf.form_of(dest);
+			if(!form || type_size(dest->ty->data.pointer.base) != 4) continue;
+			koopa_raw_value_t ptr = nullptr;
+			uint32_t step = 0, offset = form->constant;
+			bool linear = true;
+			for(auto &[term, coef] : form->terms) {
+				if(auto it = steps.find(term); it != steps.end()) {
+					auto init = start_of(term);
+					if(init->kind.tag != KOOPA_RVT_INTEGER) {
+						linear = false;
+						break;
+					}
+					step += coef * it->second;
+					offset += coef * init->kind.data.integer.value;
+				} else if(ptr == nullptr && coef == 1 && term->ty->tag == KOOPA_RTT_POINTER) {
+					ptr = term;
+				} else {
+					linear = false;
+				}
+			}
+			if(!linear || ptr == nullptr) continue;
+			auto loc = alias.locate(ptr);
+			if(loc.base == nullptr) continue;
+			auto &obj = objects[loc.base];
+			auto tag = loc.base->kind.tag;
+			if(!loc.known_offset || (tag != KOOPA_RVT_ALLOC && tag != KOOPA_RVT_GLOBAL_ALLOC) || step == 0 ||
+			   (obj.step != 0 && obj.step != (int32_t)step)) {
+				obj.broken = true;
+				continue;
+			}
+			obj.step = step;
+			obj.offsets.insert((int32_t)(loc.offset + offset));
+		}
+	}
+	std::vector<koopa_raw_value_t> ret;
+	for(auto &[base, obj] : objects) {
+		if(obj.broken) continue;
+		// the stores of a trip fill the slots of one step, the trips the object
+		int64_t width = std::abs((int64_t)obj.step), low = *obj.offsets.begin();
+		if(width % 4 != 0 || low % 4 != 0 || (int64_t)obj.offsets.size() * 4 != width) continue;
+		if(*obj.offsets.rbegin() - low != width - 4) continue;
+		int64_t first = obj.step > 0 ? low : low + obj.step * (trips - 1);
+		int64_t last = first + width * trips;
+		if(first > 0 || last < type_size(base->ty->data.pointer.base)) continue;
+		Mem_loc whole{base};
+		bool read = false;
+		for(auto &loc : reads) {
+			read |= may_alias(loc, whole);
+		}
+		for(auto call : calls) {
+			read |= alias.call_may_ref(call, whole);
+		}
+		if(!read) ret.push_back(base);
+	}
+	return ret;
+}
+
+int reduce_induction_vars(koopa_raw_function_t func) {
+	insert_preheaders(func);
+	Cfg cfg(func);
+	Dom_tree dom(cfg);
+	Loop_info info(cfg, dom);
+	int reduced = 0;
+	// inner loops first, their start addresses may then move with the outer loop
+	for(auto &loop : info.loops) {
+		if(loop->preheader != nullptr && loop->latches.size() == 1) reduced += reduce(*loop, cfg);
+	}
+	return reduced;
+}
+
+}   // namespace Koopa_Opt
@@ -0,0 +1,111 @@
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Licm_Defs {
+
+// A load may run before the loop does only if its address is surely valid.
+bool safe_to_speculate(const Mem_loc &loc) {
+	if(loc.base == nullptr || !loc.known_offset) return false;
+	auto tag = loc.base->kind.tag;
+	if(tag != KOOPA_RVT_ALLOC && tag != KOOPA_RVT_GLOBAL_ALLOC) return false;
+	return loc.offset >= 0 && loc.offset < type_size(loc.base->ty->data.pointer.base);
+}
+
+int hoist(const Loop &loop, const Cfg &cfg, const Dom_tree &dom, Alias_info &alias) {
+	std::vector<koopa_raw_basic_block_t> blks, exiting;
+	std::unordered_set<koopa_raw_value_t> defined;
+	std::vector<Mem_loc> stores;
+	std::vector<koopa_raw_value_t> calls;
+	for(auto blk : cfg.rpo) {
+		if(!loop.contains(blk)) continue;
+		blks.push_back(blk);
+		for(auto succ : cfg.succs.at(blk)) {
+			if(!loop.contains(succ)) {
+				exiting.push_back(blk);
+				break;
+			}
+		}
+		for(auto param : to_vector<koopa_raw_value_t>(blk->params)) {
+			defined.insert(param);
+		}
+		for(auto inst : get_insts(blk)) {
+			defined.insert(inst);
+			if(inst->kind.tag == KOOPA_RVT_STORE) stores.push_back(alias.locate(inst->kind.data.store.dest));
+			if(inst->kind.tag == KOOPA_RVT_CALL) calls.push_back(inst);
+		}
+	}
+	auto invariant = [&](koopa_raw_value_t val) { return !defined.contains(val); };
+	auto clobbered = [&](const Mem_loc &loc) {
+		for(auto &i : stores) {
+			if(may_alias(i, loc)) return true;
+		}
+		for(auto call : calls) {
+			if(alias.call_may_mod(call, loc)) return true;
+		}
+		return false;
+	};
+	auto always_runs = [&](koopa_raw_basic_block_t blk) {
+		for(auto i : exiting) {
+			if(!dom.dominates(blk, i)) return false;
+		}
+		return true;
+	};
+	// in reverse post order the operands of an instruction are decided before it
+	std::vector<koopa_raw_value_t> moved;
+	for(auto blk : blks) {
+		std::vector<koopa_raw_value_t> insts;
+		for(auto inst : get_insts(blk)) {
+			bool ok = false;
+			switch(inst->kind.tag) {
+			case KOOPA_RVT_BINARY:
+			case KOOPA_RVT_GET_PTR:
+			case KOOPA_RVT_GET_ELEM_PTR:
+				ok = true;
+				for_each_operand(inst, [&](koopa_raw_value_t &opr) { ok &= invariant(opr); });
+				break;
+			case KOOPA_RVT_LOAD: {
+				auto src = inst->kind.data.load.src;
+				auto loc = alias.locate(src);
+				ok = invariant(src) && !clobbered(loc) && (always_runs(blk) || safe_to_speculate(loc));
+				break;
+			}
+			default:
+				break;
+			}
+			if(ok) {
+				defined.erase(inst);
+				moved.push_back(inst);
+			} else {
+				insts.push_back(inst);
+			}
+		}
+		if(insts.size() != blk->insts.len) set_insts(blk, insts);
+	}
+	if(!moved.empty()) {
+		auto insts = get_insts(loop.preheader);
+		insts.insert(insts.end() - 1, moved.begin(), moved.end());
+		set_insts(loop.preheader, insts);
+	}
+	return moved.size();
+}
+
+}   // namespace Licm_Defs
+
+using namespace Licm_Defs;
+
+int hoist_invariants(koopa_raw_function_t func) {
+	insert_preheaders(func);
+	Cfg cfg(func);
+	Dom_tree dom(cfg);
+	Loop_info info(cfg, dom);
+	Alias_info alias(func);
+	int hoisted = 0;
+	// inner loops first, what leaves them may then leave the outer ones too
+	for(auto &loop : info.loops) {
+		if(loop->preheader != nullptr) hoisted += hoist(*loop, cfg, dom, alias);
+	}
+	return hoisted;
+}
+
+}   // namespace Koopa_Opt
@@ -0,0 +1,132 @@
+#include <map>
+#include <optional>
+#include <tuple>
+
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Load_Elim_Defs {
+
+// Values known to be in memory. Locations with a known offset are keyed by
+// (object, offset) so that different getelemptrs of the same element match,
+// other locations only by the pointer value itself.
+class Avail_set {
+public:
+	class Entry {
+	public:
+		Mem_loc loc;
+		koopa_raw_value_t val;
+		bool operator==(const Entry &) const = default;
+	};
+	using Key = std::tuple<koopa_raw_value_t, int, bool>;
+	std::map<Key, Entry> entries;
+
+	static Key key_of(koopa_raw_value_t ptr, const Mem_loc &loc) {
+		if(loc.base != nullptr && loc.known_offset) {
+			return {loc.base, loc.offset, true};
+		}
+		return {ptr, 0, false};
+	}
+	koopa_raw_value_t find(const Key &key) const {
+		auto it = entries.find(key);
+		return it == entries.end() ? nullptr : it->second.val;
+	}
+	void kill_if(const std::function<bool(const Mem_loc &)> &pred) {
+		std::erase_if(entries, [&](const auto &i) { return pred(i.second.loc); });
+	}
+	void meet(const Avail_set &other) {
+		std::erase_if(entries, [&](const auto &i) {
+			auto it = other.entries.find(i.first);
+			return it == other.entries.end() || !(it->second == i.second);
+		});
+	}
+	bool operator==(const Avail_set &) const = default;
+};
+
+// Runs one block over the incoming set. When replace is given, loads whose
+// value is already available are recorded there.
+void transfer(koopa_raw_basic_block_t blk, Avail_set &avail, Alias_info &alias,
+			  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> *replace) {
+	for(auto inst : get_insts(blk)) {
+		const auto &kind = inst->kind;
+		switch(kind.tag) {
+		case KOOPA_RVT_LOAD: {
+			auto loc = alias.locate(kind.data.load.src);
+			auto key = Avail_set::key_of(kind.data.load.src, loc);
+			if(auto val = avail.find(key); val != nullptr) {
+				if(replace != nullptr) (*replace)[inst] = val;
+			} else {
+				avail.entries[key] = {loc, inst};
+			}
+			break;
+		}
+		case KOOPA_RVT_STORE: {
+			auto loc = alias.locate(kind.data.store.dest);
+			avail.kill_if([&](const Mem_loc &i) { return may_alias(i, loc); });
+			avail.entries[Avail_set::key_of(kind.data.store.dest, loc)] = {loc, kind.data.store.value};
+			break;
+		}
+		case KOOPA_RVT_CALL:
+			avail.kill_if([&](const Mem_loc &i) { return alias.call_may_mod(inst, i); });
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+}   // namespace Load_Elim_Defs
+
+using namespace Load_Elim_Defs;
+
+int eliminate_redundant_loads(koopa_raw_function_t func) {
+	Cfg cfg(func);
+	Alias_info alias(func);
+	// available-value dataflow, blocks not visited yet count as "everything available"
+	std::unordered_map<koopa_raw_basic_block_t, Avail_set> out;
+	auto get_in = [&](koopa_raw_basic_block_t blk) {
+		std::optional<Avail_set> in;
+		if(blk == cfg.rpo.front()) {
+			return Avail_set();
+		}
+		for(auto pred : cfg.preds[blk]) {
+			auto it = out.find(pred);
+			if(it == out.end()) continue;
+			if(!in.has_value()) {
+				in = it->second;
+			} else {
+				in->meet(it->second);
+			}
+		}
+		return in.value_or(Avail_set());
+	};
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(auto blk : cfg.rpo) {
+			Avail_set now = get_in(blk);
+			transfer(blk, now, alias, nullptr);
+			auto it = out.find(blk);
+			if(it == out.end() || !(it->second == now)) {
+				out[blk] = std::move(now);
+				changed = true;
+			}
+		}
+	}
+	std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+	for(auto blk : cfg.rpo) {
+		Avail_set now = get_in(blk);
+		transfer(blk, now, alias, &replace);
+	}
+	replace_uses(func, replace);
+	for(auto blk : cfg.rpo) {
+		std::vector<koopa_raw_value_t> insts;
+		for(auto inst : get_insts(blk)) {
+			if(!replace.contains(inst)) insts.push_back(inst);
+		}
+		set_insts(blk, insts);
+	}
+	return replace.size();
+}
+
+}   // namespace Koopa_Opt
@@ -0,0 +1,93 @@
+#include <algorithm>
+
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+Loop_info::Loop_info(const Cfg &cfg, const Dom_tree &dom) {
+	// a back edge goes to a block that dominates its source, loops sharing a
+	// header are one loop
+	std::unordered_map<koopa_raw_basic_block_t, Loop *> by_header;
+	for(auto blk : cfg.rpo) {
+		for(auto succ : cfg.succs.at(blk)) {
+			if(!dom.dominates(succ, blk)) continue;
+			auto &loop = by_header[succ];
+			if(loop == nullptr) {
+				loops.push_back(std::make_unique<Loop>());
+				loop = loops.back().get();
+				loop->header = succ;
+				loop->blocks.insert(succ);
+			}
+			if(std::find(loop->latches.begin(), loop->latches.end(), blk) == loop->latches.end()) {
+				loop->latches.push_back(blk);
+			}
+			std::vector<koopa_raw_basic_block_t> work = {blk};
+			while(!work.empty()) {
+				auto now = work.back();
+				work.pop_back();
+				if(!loop->blocks.insert(now).second) continue;
+				for(auto pred : cfg.preds.at(now)) {
+					work.push_back(pred);
+				}
+			}
+		}
+	}
+	std::stable_sort(loops.begin(), loops.end(), [](const auto &a, const auto &b) { return a->blocks.size() < b->blocks.size(); });
+	// the smallest loop around a block or a header is the innermost one
+	for(size_t i = 0; i < loops.size(); i++) {
+		for(auto blk : loops[i]->blocks) {
+			innermost.insert({blk, loops[i].get()});
+		}
+		for(size_t j = i + 1; j < loops.size() && loops[i]->parent == nullptr; j++) {
+			if(loops[j]->contains(loops[i]->header)) loops[i]->parent = loops[j].get();
+		}
+	}
+	for(auto it = loops.rbegin(); it != loops.rend(); ++it) {
+		auto &loop = *it;
+		if(loop->parent != nullptr) loop->depth = loop->parent->depth + 1;
+		std::vector<koopa_raw_basic_block_t> outside;
+		for(auto pred : cfg.preds.at(loop->header)) {
+			if(!loop->contains(pred)) outside.push_back(pred);
+		}
+		if(outside.size() == 1 && cfg.succs.at(outside[0]).size() == 1) {
+			loop->preheader = outside[0];
+		}
+	}
+}
+
+int Loop_info::depth(koopa_raw_basic_block_t blk) const {
+	auto it = innermost.find(blk);
+	return it == innermost.end() ? 0 : it->second->depth;
+}
+
+int insert_preheaders(koopa_raw_function_t func) {
+	Cfg cfg(func);
+	Dom_tree dom(cfg);
+	Loop_info info(cfg, dom);
+	int added = 0;
+	for(auto &loop : info.loops) {
+		if(loop->preheader != nullptr) continue;
+		auto header = loop->header;
+		auto pre = new_block("%preheader");
+		std::vector<const void *> params;
+		for(auto param : to_vector<koopa_raw_value_t>(header->params)) {
+			auto now = new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF);
+			now->kind.data.block_arg_ref.index = params.size();
+			params.push_back(now);
+		}
+		pre->params = make_slice(params, KOOPA_RSIK_VALUE);
+		auto jump = new_value(unit_type(), KOOPA_RVT_JUMP);
+		jump->kind.data.jump.target = header;
+		jump->kind.data.jump.args = make_slice(params, KOOPA_RSIK_VALUE);
+		set_insts(pre, {jump});
+		for(auto pred : cfg.preds.at(header)) {
+			if(!loop->contains(pred)) retarget(get_terminator(pred), header, pre);
+		}
+		added++;
+	}
+	// the new blocks are reached from the entry, this adds them to the function
+	order_blocks(func);
+	return added;
+}
+
+}   // namespace Koopa_Opt
@@ -0,0 +1,290 @@
+#include <tuple>
+
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Mem2reg_Defs {
+
+using Value_map = std::unordered_map<koopa_raw_value_t, koopa_raw_value_t>;
+
+// Scalar allocs that are only ever loaded from and stored to.
+std::vector<koopa_raw_value_t> find_promotable(koopa_raw_function_t func) {
+	std::vector<koopa_raw_value_t> allocs;
+	std::unordered_set<koopa_raw_value_t> escaped;
+	for(auto blk : get_blocks(func)) {
+		for(auto inst : get_insts(blk)) {
+			const auto &kind = inst->kind;
+			if(kind.tag == KOOPA_RVT_ALLOC) {
+				auto base = inst->ty->data.pointer.base;
+				if(base->tag == KOOPA_RTT_INT32 || base->tag == KOOPA_RTT_POINTER) {
+					allocs.push_back(inst);
+				}
+				continue;
+			}
+			for_each_operand(inst, [&](koopa_raw_value_t &opr) {
+				if(opr->kind.tag != KOOPA_RVT_ALLOC) return;
+				bool is_access = (kind.tag == KOOPA_RVT_LOAD && &opr == &mut(inst)->kind.data.load.src) ||
+								 (kind.tag == KOOPA_RVT_STORE && &opr == &mut(inst)->kind.data.store.dest);
+				if(!is_access) escaped.insert(opr);
+			});
+		}
+	}
+	std::erase_if(allocs, [&](koopa_raw_value_t i) { return escaped.contains(i); });
+	return allocs;
+}
+
+koopa_raw_slice_t &args_to(koopa_raw_value_t term, int succ) {
+	auto &kind = mut(term)->kind;
+	if(kind.tag == KOOPA_RVT_JUMP) return kind.data.jump.args;
+	return succ == 0 ? kind.data.branch.true_args : kind.data.branch.false_args;
+}
+
+void push_args(koopa_raw_value_t term, int succ, const std::vector<koopa_raw_value_t> &vals) {
+	auto &args = args_to(term, succ);
+	auto now = to_vector<const void *>(args);
+	now.insert(now.end(), vals.begin(), vals.end());
+	args = make_slice(now, KOOPA_RSIK_VALUE);
+}
+
+koopa_raw_value_t add_param(koopa_raw_basic_block_t blk, koopa_raw_type_t ty) {
+	auto param = new_value(ty, KOOPA_RVT_BLOCK_ARG_REF);
+	auto params = to_vector<const void *>(blk->params);
+	param->kind.data.block_arg_ref.index = params.size();
+	params.push_back(param);
+	mut(blk)->params = make_slice(params, KOOPA_RSIK_VALUE);
+	return param;
+}
+
+// Places a block parameter for every alloc on the iterated dominance frontier
+// of its stores. Returns, per block, the allocs its new parameters stand for.
+std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_value_t>>
+place_params(const Cfg &cfg, const Dom_tree &dom, const std::vector<koopa_raw_value_t> &allocs) {
+	std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_basic_block_t>> def_blocks;
+	std::unordered_set<koopa_raw_value_t> promoted(allocs.begin(), allocs.end());
+	for(auto blk : cfg.rpo) {
+		for(auto inst : get_insts(blk)) {
+			if(inst->kind.tag == KOOPA_RVT_STORE && promoted.contains(inst->kind.data.store.dest)) {
+				def_blocks[inst->kind.data.store.dest].push_back(blk);
+			}
+		}
+	}
+	std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_value_t>> ret;
+	for(auto alloc : allocs) {
+		std::unordered_set<koopa_raw_basic_block_t> has_param;
+		auto work = def_blocks[alloc];
+		while(!work.empty()) {
+			auto blk = work.back();
+			work.pop_back();
+			for(auto df : dom.frontier.at(blk)) {
+				if(has_param.insert(df).second) {
+					ret[df].push_back(alloc);
+					work.push_back(df);
+				}
+			}
+		}
+	}
+	return ret;
+}
+
+// Walks the dominator tree keeping the current value of every alloc, drops
+// the loads and stores of promoted allocs and fills in the jump arguments.
+void rename(const Cfg &cfg, const Dom_tree &dom, const std::vector<koopa_raw_value_t> &allocs,
+			const std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_value_t>> &param_allocs,
+			Value_map &replace) {
+	std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> current;
+	std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> undef;
+	for(auto alloc : allocs) {
+		current[alloc];
+		// reading a local before it is written is undefined in SysY
+		undef[alloc] = new_value(alloc->ty->data.pointer.base, KOOPA_RVT_UNDEF);
+	}
+	auto resolve = [&](koopa_raw_value_t val) {
+		for(auto it = replace.find(val); it != replace.end(); it = replace.find(val)) {
+			val = it->second;
+		}
+		return val;
+	};
+	auto top = [&](koopa_raw_value_t alloc) {
+		auto &stk = current[alloc];
+		return stk.empty() ? undef[alloc] : stk.back();
+	};
+	std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_value_t>> new_params;
+	for(auto &[blk, list] : param_allocs) {
+		for(auto alloc : list) {
+			new_params[blk].push_back(add_param(blk, alloc->ty->data.pointer.base));
+		}
+	}
+	// iterative walk, the log records which allocs got a new value in each block
+	std::vector<koopa_raw_value_t> log;
+	std::vector<std::tuple<koopa_raw_basic_block_t, size_t, size_t>> stk;
+	stk.push_back({cfg.rpo.front(), 0, 0});
+	while(!stk.empty()) {
+		auto &[blk, child, log_size] = stk.back();
+		if(child == 0) {
+			log_size = log.size();
+			if(auto it = param_allocs.find(blk); it != param_allocs.end()) {
+				for(size_t i = 0; i < it->second.size(); i++) {
+					current[it->second[i]].push_back(new_params[blk][i]);
+					log.push_back(it->second[i]);
+				}
+			}
+			std::vector<koopa_raw_value_t> insts;
+			for(auto inst : get_insts(blk)) {
+				const auto &kind = inst->kind;
+				if(kind.tag == KOOPA_RVT_LOAD && current.contains(kind.data.load.src)) {
+					replace[inst] = top(kind.data.load.src);
+				} else if(kind.tag == KOOPA_RVT_STORE && current.contains(kind.data.store.dest)) {
+					current[kind.data.store.dest].push_back(resolve(kind.data.store.value));
+					log.push_back(kind.data.store.dest);
+				} else if(!(kind.tag == KOOPA_RVT_ALLOC && current.contains(inst))) {
+					insts.push_back(inst);
+				}
+			}
+			set_insts(blk, insts);
+			auto succs = cfg.succs.at(blk);
+			for(size_t i = 0; i < succs.size(); i++) {
+				auto it = param_allocs.find(succs[i]);
+				if(it == param_allocs.end()) continue;
+				std::vector<koopa_raw_value_t> vals;
+				for(auto alloc : it->second) {
+					vals.push_back(top(alloc));
+				}
+				push_args(get_terminator(blk), i, vals);
+			}
+		}
+		auto &kids = dom.children.at(blk);
+		if(child < kids.size()) {
+			auto nxt = kids[child];
+			child++;
+			stk.push_back({nxt, 0, 0});
+			continue;
+		}
+		while(log.size() > log_size) {
+			current[log.back()].pop_back();
+			log.pop_back();
+		}
+		stk.pop_back();
+	}
+}
+
+// Block parameters with their incoming arguments, one vector per predecessor edge.
+std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> incoming_args(const Cfg &cfg) {
+	std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> ret;
+	for(auto blk : cfg.rpo) {
+		auto term = get_terminator(blk);
+		auto succs = cfg.succs.at(blk);
+		for(size_t i = 0; i < succs.size(); i++) {
+			auto args = to_vector<koopa_raw_value_t>(args_to(term, i));
+			for(size_t j = 0; j < args.size(); j++) {
+				ret[(koopa_raw_value_t)succs[i]->params.buffer[j]].push_back(args[j]);
+			}
+		}
+	}
+	return ret;
+}
+
+// Removes parameters that only ever get one value from outside, and those
+// whose value is never used but to feed other parameters.
+int simplify_params(koopa_raw_function_t func, const Cfg &cfg) {
+	Value_map replace;
+	auto resolve = [&](koopa_raw_value_t val) {
+		for(auto it = replace.find(val); it != replace.end(); it = replace.find(val)) {
+			val = it->second;
+		}
+		return val;
+	};
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(auto &[param, args] : incoming_args(cfg)) {
+			if(replace.contains(param)) continue;
+			koopa_raw_value_t same = nullptr;
+			bool trivial = true;
+			for(auto arg : args) {
+				arg = resolve(arg);
+				if(arg == param || arg == same) continue;
+				if(same != nullptr) trivial = false;
+				same = arg;
+			}
+			if(trivial && same != nullptr) {
+				replace[param] = same;
+				changed = true;
+			}
+		}
+		replace_uses(func, replace);
+	}
+	std::unordered_set<koopa_raw_value_t> used;
+	for(auto blk : cfg.rpo) {
+		for(auto inst : get_insts(blk)) {
+			auto &kind = mut(inst)->kind;
+			switch(kind.tag) {
+			case KOOPA_RVT_BRANCH:
+				used.insert(kind.data.branch.cond);
+				break;
+			case KOOPA_RVT_JUMP:
+				break;
+			default:
+				for_each_operand(inst, [&](koopa_raw_value_t &opr) { used.insert(opr); });
+				break;
+			}
+		}
+	}
+	auto incoming = incoming_args(cfg);
+	std::vector<koopa_raw_value_t> work(used.begin(), used.end());
+	while(!work.empty()) {
+		auto val = work.back();
+		work.pop_back();
+		if(val->kind.tag != KOOPA_RVT_BLOCK_ARG_REF) continue;
+		for(auto arg : incoming[val]) {
+			if(used.insert(arg).second) work.push_back(arg);
+		}
+	}
+	int removed = 0;
+	std::unordered_map<koopa_raw_basic_block_t, std::vector<bool>> keep;
+	for(auto blk : cfg.rpo) {
+		std::vector<const void *> params;
+		for(auto param : to_vector<koopa_raw_value_t>(blk->params)) {
+			bool alive = used.contains(param) && !replace.contains(param);
+			keep[blk].push_back(alive);
+			if(alive) {
+				mut(param)->kind.data.block_arg_ref.index = params.size();
+				params.push_back(param);
+			} else {
+				removed++;
+			}
+		}
+		mut(blk)->params = make_slice(params, KOOPA_RSIK_VALUE);
+	}
+	for(auto blk : cfg.rpo) {
+		auto term = get_terminator(blk);
+		auto succs = cfg.succs.at(blk);
+		for(size_t i = 0; i < succs.size(); i++) {
+			std::vector<const void *> args;
+			auto old = to_vector<koopa_raw_value_t>(args_to(term, i));
+			for(size_t j = 0; j < old.size(); j++) {
+				if(keep[succs[i]][j]) args.push_back(old[j]);
+			}
+			args_to(term, i) = make_slice(args, KOOPA_RSIK_VALUE);
+		}
+	}
+	return removed;
+}
+
+}   // namespace Mem2reg_Defs
+
+using namespace Mem2reg_Defs;
+
+int promote_allocs(koopa_raw_function_t func) {
+	auto allocs = find_promotable(func);
+	if(allocs.empty()) return 0;
+	Cfg cfg(func);
+	Dom_tree dom(cfg);
+	auto param_allocs = place_params(cfg, dom, allocs);
+	Value_map replace;
+	rename(cfg, dom, allocs, param_allocs, replace);
+	replace_uses(func, replace);
+	simplify_params(func, cfg);
+	return allocs.size();
+}
+
+}   // namespace Koopa_Opt
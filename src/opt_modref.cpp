@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <string>
+
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Mod_Ref_Defs {
+
+// Effects of the sysy runtime on the memory of the program, by argument index.
+class Lib_effect {
+public:
+	std::vector<int> mod_params, ref_params;
+};
+
+std::map<std::string, Lib_effect> sysy_lib_effects = {
+	{"@getint", {}},
+	{"@getch", {}},
+	{"@getarray", {{0}, {}}},
+	{"@putint", {}},
+	{"@putch", {}},
+	{"@putarray", {{}, {1}}},
+	{"@starttime", {}},
+	{"@stoptime", {}},
+};
+
+std::unordered_map<koopa_raw_function_t, Mod_ref> summaries;
+
+// Summaries of functions defined in earlier programs of a streamed
+// compilation, which only see them as decls. Globals are kept by name.
+class Saved_mod_ref {
+public:
+	std::vector<std::string> mod_globals, ref_globals;
+	std::vector<bool> mod_params, ref_params;
+	bool mod_unknown, ref_unknown;
+};
+
+std::unordered_map<std::string, Saved_mod_ref> saved_summaries;
+std::unordered_map<std::string, koopa_raw_value_t> globals_by_name;
+
+void restore(Mod_ref &ret, const Saved_mod_ref &saved) {
+	ret.mod_params = saved.mod_params;
+	ret.ref_params = saved.ref_params;
+	ret.mod_unknown = saved.mod_unknown;
+	ret.ref_unknown = saved.ref_unknown;
+	auto add = [&](const std::vector<std::string> &names, std::unordered_set<koopa_raw_value_t> &globals, bool &unknown) {
+		for(auto &i : names) {
+			auto it = globals_by_name.find(i);
+			if(it == globals_by_name.end()) {
+				unknown = true;
+			} else {
+				globals.insert(it->second);
+			}
+		}
+	};
+	add(saved.mod_globals, ret.mod_globals, ret.mod_unknown);
+	add(saved.ref_globals, ret.ref_globals, ret.ref_unknown);
+}
+
+void save(koopa_raw_function_t func, const Mod_ref &sum) {
+	auto &saved = saved_summaries[func->name];
+	saved = {{}, {}, sum.mod_params, sum.ref_params, sum.mod_unknown, sum.ref_unknown};
+	for(auto g : sum.mod_globals) saved.mod_globals.push_back(g->name);
+	for(auto g : sum.ref_globals) saved.ref_globals.push_back(g->name);
+}
+
+bool is_object(koopa_raw_value_t base) {
+	return base->kind.tag == KOOPA_RVT_ALLOC || base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC;
+}
+
+void add_effect(Mod_ref &ret, const Mem_loc &loc, bool is_mod) {
+	if(loc.base == nullptr) {
+		(is_mod ? ret.mod_unknown : ret.ref_unknown) = true;
+		return;
+	}
+	switch(loc.base->kind.tag) {
+	case KOOPA_RVT_GLOBAL_ALLOC:
+		(is_mod ? ret.mod_globals : ret.ref_globals).insert(loc.base);
+		break;
+	case KOOPA_RVT_FUNC_ARG_REF:
+		(is_mod ? ret.mod_params : ret.ref_params)[loc.base->kind.data.func_arg_ref.index] = true;
+		break;
+	default:
+		// locals of the function are invisible to its callers
+		break;
+	}
+}
+
+void add_call_effect(Mod_ref &ret, koopa_raw_value_t call, Alias_info &alias) {
+	auto &callee = get_mod_ref(call->kind.data.call.callee);
+	auto args = to_vector<koopa_raw_value_t>(call->kind.data.call.args);
+	ret.mod_unknown |= callee.mod_unknown;
+	ret.ref_unknown |= callee.ref_unknown;
+	ret.mod_globals.insert(callee.mod_globals.begin(), callee.mod_globals.end());
+	ret.ref_globals.insert(callee.ref_globals.begin(), callee.ref_globals.end());
+	for(size_t i = 0; i < args.size(); i++) {
+		if(callee.mod_params[i]) add_effect(ret, alias.locate(args[i]), true);
+		if(callee.ref_params[i]) add_effect(ret, alias.locate(args[i]), false);
+	}
+}
+
+Mod_ref summarize(koopa_raw_function_t func) {
+	Mod_ref ret;
+	ret.mod_params.assign(func->ty->data.function.params.len, false);
+	ret.ref_params.assign(func->ty->data.function.params.len, false);
+	if(func->bbs.len == 0) {
+		auto it = sysy_lib_effects.find(func->name);
+		if(it == sysy_lib_effects.end()) {
+			if(auto saved = saved_summaries.find(func->name); saved != saved_summaries.end()) {
+				restore(ret, saved->second);
+			} else {
+				ret.mod_unknown = ret.ref_unknown = true;
+			}
+			return ret;
+		}
+		for(int i : it->second.mod_params) ret.mod_params[i] = true;
+		for(int i : it->second.ref_params) ret.ref_params[i] = true;
+		return ret;
+	}
+	Alias_info alias(func);
+	for(auto blk : get_blocks(func)) {
+		for(auto inst : get_insts(blk)) {
+			switch(inst->kind.tag) {
+			case KOOPA_RVT_LOAD:
+				add_effect(ret, alias.locate(inst->kind.data.load.src), false);
+				break;
+			case KOOPA_RVT_STORE:
+				add_effect(ret, alias.locate(inst->kind.data.store.dest), true);
+				break;
+			case KOOPA_RVT_CALL:
+				add_call_effect(ret, inst, alias);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	return ret;
+}
+
+std::string describe(const std::unordered_set<koopa_raw_value_t> &globals, const std::vector<bool> &params,
+					 bool unknown, koopa_raw_function_t func) {
+	std::string ret;
+	for(size_t i = 0; i < params.size(); i++) {
+		if(params[i]) ret += std::string(" ") + ((koopa_raw_value_t)func->params.buffer[i])->name;
+	}
+	std::vector<std::string> names;
+	for(auto g : globals) {
+		names.push_back(g->name);
+	}
+	std::sort(names.begin(), names.end());
+	for(auto& i : names) {
+		ret += " " + i;
+	}
+	if(unknown) ret += " <unknown>";
+	return ret.empty() ? " -" : ret;
+}
+
+}   // namespace Mod_Ref_Defs
+
+using namespace Mod_Ref_Defs;
+
+bool may_alias(const Mem_loc &a, const Mem_loc &b) {
+	if(a.base == nullptr || b.base == nullptr) {
+		return true;
+	}
+	if(a.base == b.base) {
+		return !(a.known_offset && b.known_offset && a.offset != b.offset);
+	}
+	bool a_local = a.base->kind.tag == KOOPA_RVT_ALLOC, b_local = b.base->kind.tag == KOOPA_RVT_ALLOC;
+	if(is_object(a.base) && is_object(b.base)) {
+		return false;
+	}
+	// a pointer parameter never points into the frame of its own function
+	if(a_local || b_local) {
+		return false;
+	}
+	return true;
+}
+
+Alias_info::Alias_info(koopa_raw_function_t func) {
+	for(auto blk : get_blocks(func)) {
+		for(auto inst : get_insts(blk)) {
+			if(inst->kind.tag != KOOPA_RVT_STORE) continue;
+			auto dest = inst->kind.data.store.dest;
+			if(dest->kind.tag != KOOPA_RVT_ALLOC || dest->ty->data.pointer.base->tag != KOOPA_RTT_POINTER) continue;
+			auto src = inst->kind.data.store.value;
+			auto [it, inserted] = ptr_slot_src.insert({dest, src});
+			if(!inserted && it->second != src) {
+				it->second = nullptr;
+			}
+		}
+	}
+	// a pointer carried through block arguments, as loops do, keeps the object
+	// all its incoming values point into; found optimistically around cycles
+	std::vector<std::pair<koopa_raw_value_t, koopa_raw_value_t>> incoming;
+	auto add_edge = [&](koopa_raw_basic_block_t target, const koopa_raw_slice_t &args) {
+		for(size_t i = 0; i < args.len; i++) {
+			auto param = (koopa_raw_value_t)target->params.buffer[i];
+			if(param->ty->tag == KOOPA_RTT_POINTER) incoming.push_back({param, (koopa_raw_value_t)args.buffer[i]});
+		}
+	};
+	for(auto blk : get_blocks(func)) {
+		auto term = get_terminator(blk);
+		if(term->kind.tag == KOOPA_RVT_BRANCH) {
+			add_edge(term->kind.data.branch.true_bb, term->kind.data.branch.true_args);
+			add_edge(term->kind.data.branch.false_bb, term->kind.data.branch.false_args);
+		} else if(term->kind.tag == KOOPA_RVT_JUMP) {
+			add_edge(term->kind.data.jump.target, term->kind.data.jump.args);
+		}
+	}
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(auto [param, arg] : incoming) {
+			while(arg->kind.tag == KOOPA_RVT_GET_PTR || arg->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+				arg = arg->kind.data.get_elem_ptr.src;
+			}
+			koopa_raw_value_t base = nullptr;
+			if(arg->kind.tag == KOOPA_RVT_BLOCK_ARG_REF) {
+				auto it = param_base.find(arg);
+				if(it == param_base.end()) continue;   // nothing known yet
+				base = it->second;
+			} else {
+				base = locate(arg).base;
+			}
+			auto [it, inserted] = param_base.insert({param, base});
+			if(!inserted && it->second != base && it->second != nullptr) {
+				it->second = nullptr;
+				changed = true;
+			}
+			changed |= inserted;
+		}
+	}
+	cache.clear();
+}
+
+Mem_loc Alias_info::locate(koopa_raw_value_t ptr) {
+	if(auto it = cache.find(ptr); it != cache.end()) {
+		return it->second;
+	}
+	Mem_loc ret;
+	const auto &kind = ptr->kind;
+	switch(kind.tag) {
+	case KOOPA_RVT_ALLOC:
+	case KOOPA_RVT_GLOBAL_ALLOC:
+	case KOOPA_RVT_FUNC_ARG_REF:
+		ret = {ptr, true, 0};
+		break;
+	case KOOPA_RVT_GET_PTR:
+	case KOOPA_RVT_GET_ELEM_PTR: {
+		auto src = kind.data.get_elem_ptr.src;
+		auto index = kind.data.get_elem_ptr.index;
+		auto pointee = src->ty->data.pointer.base;
+		int stride = type_size(kind.tag == KOOPA_RVT_GET_PTR ? pointee : pointee->data.array.base);
+		ret = locate(src);
+		if(ret.known_offset && index->kind.tag == KOOPA_RVT_INTEGER) {
+			ret.offset += index->kind.data.integer.value * stride;
+		} else {
+			ret.known_offset = false;
+		}
+		break;
+	}
+	case KOOPA_RVT_BLOCK_ARG_REF:
+		if(auto it = param_base.find(ptr); it != param_base.end() && it->second != nullptr) {
+			ret = {it->second, false, 0};
+		}
+		break;
+	case KOOPA_RVT_LOAD:
+		// array parameters are spilled into a local slot right at entry
+		if(auto it = ptr_slot_src.find(kind.data.load.src); it != ptr_slot_src.end() && it->second != nullptr) {
+			ret = locate(it->second);
+		}
+		break;
+	default:
+		break;
+	}
+	cache[ptr] = ret;
+	return ret;
+}
+
+bool Alias_info::call_may_mod(koopa_raw_value_t call, const Mem_loc &loc) {
+	auto &callee = get_mod_ref(call->kind.data.call.callee);
+	if(callee.mod_unknown) return true;
+	for(auto g : callee.mod_globals) {
+		if(may_alias(loc, Mem_loc{g})) return true;
+	}
+	for(size_t i = 0; i < callee.mod_params.size(); i++) {
+		if(callee.mod_params[i] && may_alias(loc, Mem_loc{locate((koopa_raw_value_t)call->kind.data.call.args.buffer[i]).base})) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Alias_info::call_may_ref(koopa_raw_value_t call, const Mem_loc &loc) {
+	auto &callee = get_mod_ref(call->kind.data.call.callee);
+	if(callee.ref_unknown) return true;
+	for(auto g : callee.ref_globals) {
+		if(may_alias(loc, Mem_loc{g})) return true;
+	}
+	for(size_t i = 0; i < callee.ref_params.size(); i++) {
+		if(callee.ref_params[i] && may_alias(loc, Mem_loc{locate((koopa_raw_value_t)call->kind.data.call.args.buffer[i]).base})) {
+			return true;
+		}
+	}
+	return false;
+}
+
+const Mod_ref &get_mod_ref(koopa_raw_function_t func) {
+	auto it = summaries.find(func);
+	if(it == summaries.end()) {
+		// not summarized yet: start from "touches nothing" and let the fixpoint grow it
+		Mod_ref empty;
+		empty.mod_params.assign(func->ty->data.function.params.len, false);
+		empty.ref_params.assign(func->ty->data.function.params.len, false);
+		if(func->bbs.len == 0) {
+			empty = summarize(func);
+		}
+		it = summaries.insert({func, empty}).first;
+	}
+	return it->second;
+}
+
+std::vector<std::string> saved_mod_ref_globals(const std::string &func) {
+	auto it = saved_summaries.find(func);
+	if(it == saved_summaries.end()) return {};
+	auto ret = it->second.mod_globals;
+	ret.insert(ret.end(), it->second.ref_globals.begin(), it->second.ref_globals.end());
+	return ret;
+}
+
+void analyze_mod_ref(const koopa_raw_program_t &prog) {
+	summaries.clear();
+	globals_by_name.clear();
+	for(auto val : to_vector<koopa_raw_value_t>(prog.values)) {
+		globals_by_name[val->name] = val;
+	}
+	auto funcs = to_vector<koopa_raw_function_t>(prog.funcs);
+	// summaries only grow, so iterating to a fixpoint handles recursion
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(auto func : funcs) {
+			Mod_ref now = summarize(func);
+			if(!(get_mod_ref(func) == now)) {
+				summaries[func] = now;
+				changed = true;
+			}
+		}
+	}
+	for(auto func : funcs) {
+		if(func->bbs.len == 0) continue;
+		auto &sum = summaries[func];
+		save(func, sum);
+		report("mod-ref", func, "mod" + describe(sum.mod_globals, sum.mod_params, sum.mod_unknown, func) +
+									", ref" + describe(sum.ref_globals, sum.ref_params, sum.ref_unknown, func));
+	}
+}
+
+}   // namespace Koopa_Opt
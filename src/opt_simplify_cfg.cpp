@@ -0,0 +1,210 @@
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Simplify_Cfg_Defs {
+
+using Value_map = std::unordered_map<koopa_raw_value_t, koopa_raw_value_t>;
+
+class Edge {
+public:
+	koopa_raw_basic_block_t target;
+	std::vector<koopa_raw_value_t> args;
+};
+
+Edge get_edge(koopa_raw_value_t term, int succ) {
+	const auto &kind = term->kind;
+	if(kind.tag == KOOPA_RVT_JUMP) {
+		return {kind.data.jump.target, to_vector<koopa_raw_value_t>(kind.data.jump.args)};
+	}
+	if(succ == 0) {
+		return {kind.data.branch.true_bb, to_vector<koopa_raw_value_t>(kind.data.branch.true_args)};
+	}
+	return {kind.data.branch.false_bb, to_vector<koopa_raw_value_t>(kind.data.branch.false_args)};
+}
+
+void set_edge(koopa_raw_value_t term, int succ, const Edge &edge) {
+	auto &kind = mut(term)->kind;
+	auto args = make_slice(std::vector<const void *>(edge.args.begin(), edge.args.end()), KOOPA_RSIK_VALUE);
+	if(kind.tag == KOOPA_RVT_JUMP) {
+		kind.data.jump.target = edge.target;
+		kind.data.jump.args = args;
+	} else if(succ == 0) {
+		kind.data.branch.true_bb = edge.target;
+		kind.data.branch.true_args = args;
+	} else {
+		kind.data.branch.false_bb = edge.target;
+		kind.data.branch.false_args = args;
+	}
+}
+
+void make_jump(koopa_raw_value_t term, const Edge &edge) {
+	auto &kind = mut(term)->kind;
+	kind.tag = KOOPA_RVT_JUMP;
+	set_edge(term, 0, edge);
+}
+
+int count_terminators(koopa_raw_function_t func, koopa_raw_value_tag_t tag) {
+	int ret = 0;
+	for(auto blk : get_blocks(func)) {
+		ret += get_terminator(blk)->kind.tag == tag;
+	}
+	return ret;
+}
+
+std::unordered_map<koopa_raw_value_t, int> count_uses(koopa_raw_function_t func) {
+	std::unordered_map<koopa_raw_value_t, int> ret;
+	for(auto blk : get_blocks(func)) {
+		for(auto inst : get_insts(blk)) {
+			for_each_operand(inst, [&](koopa_raw_value_t &opr) { ret[opr]++; });
+		}
+	}
+	return ret;
+}
+
+// A block that holds nothing but its terminator, and whose parameters are
+// only read by that terminator. Edges into it can go straight to where it goes.
+bool is_pass_through(koopa_raw_basic_block_t blk, const std::unordered_map<koopa_raw_value_t, int> &uses) {
+	if(blk->insts.len != 1) return false;
+	std::unordered_map<koopa_raw_value_t, int> local;
+	for_each_operand(get_terminator(blk), [&](koopa_raw_value_t &opr) { local[opr]++; });
+	for(auto param : to_vector<koopa_raw_value_t>(blk->params)) {
+		auto it = uses.find(param);
+		if(it != uses.end() && it->second != local[param]) return false;
+	}
+	return true;
+}
+
+// Where an edge into a pass-through block ends up, if that is known from the
+// arguments of the edge alone.
+bool thread_edge(const Edge &edge, Edge &ret) {
+	auto term = get_terminator(edge.target);
+	Value_map subst;
+	for(size_t i = 0; i < edge.args.size(); i++) {
+		subst[(koopa_raw_value_t)edge.target->params.buffer[i]] = edge.args[i];
+	}
+	auto apply = [&](koopa_raw_value_t val) {
+		auto it = subst.find(val);
+		return it == subst.end() ? val : it->second;
+	};
+	int succ = 0;
+	if(term->kind.tag == KOOPA_RVT_BRANCH) {
+		auto cond = apply(term->kind.data.branch.cond);
+		if(cond->kind.tag != KOOPA_RVT_INTEGER) return false;
+		succ = cond->kind.data.integer.value != 0 ? 0 : 1;
+	} else if(term->kind.tag != KOOPA_RVT_JUMP) {
+		return false;
+	}
+	ret = get_edge(term, succ);
+	for(auto &arg : ret.args) {
+		arg = apply(arg);
+	}
+	return ret.target != edge.target;
+}
+
+// Branches on a constant, or to the same place either way, become jumps.
+int fold_branches(koopa_raw_function_t func) {
+	int folded = 0;
+	for(auto blk : get_blocks(func)) {
+		auto term = get_terminator(blk);
+		if(term->kind.tag != KOOPA_RVT_BRANCH) continue;
+		auto cond = term->kind.data.branch.cond;
+		auto t = get_edge(term, 0), f = get_edge(term, 1);
+		if(cond->kind.tag == KOOPA_RVT_INTEGER) {
+			make_jump(term, cond->kind.data.integer.value != 0 ? t : f);
+		} else if(t.target == f.target && t.args == f.args) {
+			make_jump(term, t);
+		} else {
+			continue;
+		}
+		folded++;
+	}
+	return folded;
+}
+
+int thread_jumps(koopa_raw_function_t func) {
+	int threaded = 0;
+	auto uses = count_uses(func);
+	std::unordered_map<koopa_raw_basic_block_t, bool> pass_through;
+	for(auto blk : get_blocks(func)) {
+		pass_through[blk] = is_pass_through(blk, uses);
+	}
+	for(auto blk : get_blocks(func)) {
+		auto term = get_terminator(blk);
+		int n = term->kind.tag == KOOPA_RVT_BRANCH ? 2 : term->kind.tag == KOOPA_RVT_JUMP ? 1 : 0;
+		for(int i = 0; i < n; i++) {
+			// follow a chain of pass-through blocks, bounded in case of an empty loop
+			Edge edge = get_edge(term, i), nxt;
+			bool moved = false;
+			for(int step = 0; step < 16 && edge.target != blk && pass_through[edge.target] && thread_edge(edge, nxt); step++) {
+				edge = nxt;
+				moved = true;
+			}
+			if(moved) {
+				set_edge(term, i, edge);
+				threaded++;
+			}
+		}
+	}
+	return threaded;
+}
+
+// Appends a block to its only predecessor when that one jumps to it.
+int merge_blocks(koopa_raw_function_t func) {
+	Cfg cfg(func);
+	auto entry = cfg.rpo.front();
+	std::unordered_set<koopa_raw_basic_block_t> merged;
+	Value_map replace;
+	for(auto blk : cfg.rpo) {
+		if(merged.contains(blk)) continue;
+		while(true) {
+			auto term = get_terminator(blk);
+			if(term->kind.tag != KOOPA_RVT_JUMP) break;
+			auto succ = term->kind.data.jump.target;
+			if(succ == blk || succ == entry || cfg.preds[succ].size() != 1) break;
+			auto args = to_vector<koopa_raw_value_t>(term->kind.data.jump.args);
+			for(size_t i = 0; i < args.size(); i++) {
+				replace[(koopa_raw_value_t)succ->params.buffer[i]] = args[i];
+			}
+			auto insts = get_insts(blk);
+			insts.pop_back();
+			for(auto inst : get_insts(succ)) {
+				insts.push_back(inst);
+			}
+			set_insts(blk, insts);
+			merged.insert(succ);
+		}
+	}
+	std::vector<koopa_raw_basic_block_t> blks;
+	for(auto blk : cfg.rpo) {
+		if(!merged.contains(blk)) blks.push_back(blk);
+	}
+	set_blocks(func, blks);
+	replace_uses(func, replace);
+	return merged.size();
+}
+
+}   // namespace Simplify_Cfg_Defs
+
+using namespace Simplify_Cfg_Defs;
+
+int simplify_cfg(koopa_raw_function_t func) {
+	int blocks = func->bbs.len;
+	int jumps = count_terminators(func, KOOPA_RVT_JUMP), branches = count_terminators(func, KOOPA_RVT_BRANCH);
+	int changes = 0;
+	for(bool changed = true; changed;) {
+		int now = fold_branches(func) + thread_jumps(func);
+		order_blocks(func);
+		now += merge_blocks(func);
+		changed = now > 0;
+		changes += now;
+	}
+	report("simplify-cfg", func,
+		   "blocks " + std::to_string(blocks) + " -> " + std::to_string(func->bbs.len) + ", jumps " +
+			   std::to_string(jumps) + " -> " + std::to_string(count_terminators(func, KOOPA_RVT_JUMP)) +
+			   ", branches " + std::to_string(branches) + " -> " +
+			   std::to_string(count_terminators(func, KOOPA_RVT_BRANCH)));
+	return changes;
+}
+
+}   // namespace Koopa_Opt
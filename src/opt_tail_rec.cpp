@@ -0,0 +1,91 @@
+#include "opt.hpp"
+
+namespace Koopa_Opt {
+
+namespace Tail_Rec_Defs {
+
+// Whether term returns val right away, either itself or through a block that
+// does nothing but return its parameter. val is nullptr for a unit call.
+bool returns_value(koopa_raw_value_t term, koopa_raw_value_t val) {
+	if(term->kind.tag == KOOPA_RVT_RETURN) {
+		return val == nullptr || term->kind.data.ret.value == val;
+	}
+	if(term->kind.tag != KOOPA_RVT_JUMP) return false;
+	auto target = term->kind.data.jump.target;
+	if(target->insts.len != 1) return false;
+	auto ret = get_terminator(target);
+	if(ret->kind.tag != KOOPA_RVT_RETURN) return false;
+	if(val == nullptr) return true;
+	auto args = to_vector<koopa_raw_value_t>(term->kind.data.jump.args);
+	for(size_t i = 0; i < args.size(); i++) {
+		if(args[i] == val && ret->kind.data.ret.value == target->params.buffer[i]) return true;
+	}
+	return false;
+}
+
+}   // namespace Tail_Rec_Defs
+
+using namespace Tail_Rec_Defs;
+
+int eliminate_tail_recursion(koopa_raw_function_t func) {
+	Alias_info alias(func);
+	std::vector<koopa_raw_basic_block_t> sites;
+	for(auto blk : get_blocks(func)) {
+		auto insts = get_insts(blk);
+		if(insts.size() < 2) continue;
+		auto call = insts[insts.size() - 2];
+		if(call->kind.tag != KOOPA_RVT_CALL || call->kind.data.call.callee != func) continue;
+		if(!returns_value(insts.back(), call->ty->tag == KOOPA_RTT_UNIT ? nullptr : call)) continue;
+		// the frame is reused, so the callee must not get pointers into it
+		bool ok = true;
+		for(auto arg : to_vector<koopa_raw_value_t>(call->kind.data.call.args)) {
+			auto base = alias.locate(arg).base;
+			if(arg->ty->tag == KOOPA_RTT_POINTER && (base == nullptr || base->kind.tag == KOOPA_RVT_ALLOC)) ok = false;
+		}
+		if(ok) sites.push_back(blk);
+	}
+	if(sites.empty()) return 0;
+	// the old entry becomes the loop header, taking the parameters as block arguments
+	auto blks = get_blocks(func);
+	auto header = blks.front();
+	auto entry = new_block("%tail_entry");
+	std::vector<const void *> params, args;
+	std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+	for(auto arg : to_vector<koopa_raw_value_t>(func->params)) {
+		auto param = new_value(arg->ty, KOOPA_RVT_BLOCK_ARG_REF);
+		param->kind.data.block_arg_ref.index = params.size();
+		params.push_back(param);
+		args.push_back(arg);
+		replace[arg] = param;
+	}
+	mut(header)->params = make_slice(params, KOOPA_RSIK_VALUE);
+	replace_uses(func, replace);
+	std::vector<koopa_raw_value_t> entry_insts;
+	for(auto blk : blks) {
+		std::vector<koopa_raw_value_t> insts;
+		for(auto inst : get_insts(blk)) {
+			(inst->kind.tag == KOOPA_RVT_ALLOC ? entry_insts : insts).push_back(inst);
+		}
+		set_insts(blk, insts);
+	}
+	auto jump = new_value(unit_type(), KOOPA_RVT_JUMP);
+	jump->kind.data.jump.target = header;
+	jump->kind.data.jump.args = make_slice(args, KOOPA_RSIK_VALUE);
+	entry_insts.push_back(jump);
+	set_insts(entry, entry_insts);
+	for(auto blk : sites) {
+		auto insts = get_insts(blk);
+		insts.pop_back();
+		auto call = insts.back();
+		auto back = new_value(unit_type(), KOOPA_RVT_JUMP);
+		back->kind.data.jump.target = header;
+		back->kind.data.jump.args = call->kind.data.call.args;
+		insts.back() = back;
+		set_insts(blk, insts);
+	}
+	blks.insert(blks.begin(), entry);
+	set_blocks(func, blks);
+	return sites.size();
+}
+
+}   // namespace Koopa_Opt
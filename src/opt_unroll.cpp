@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "opt.hpp"
+#include "options.hpp"
+
+namespace Koopa_Opt {
+
+namespace Unroll_Defs {
+
+const int max_size = 256;   // instructions a loop may grow to
+const int max_full_trips = 32;
+const int max_step = 1 << 20;   // keeps (factor - 1) * step inside i32
+
+using Value_map = std::unordered_map<koopa_raw_value_t, koopa_raw_value_t>;
+
+void point(koopa_raw_value_t jump, koopa_raw_basic_block_t target, const std::vector<koopa_raw_value_t> &args) {
+	auto &kind = mut(jump)->kind;
+	kind.data.jump.target = target;
+	kind.data.jump.args = make_slice(std::vector<const void *>(args.begin(), args.end()), KOOPA_RSIK_VALUE);
+}
+
+koopa_raw_value_data_t *new_binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs) {
+	auto val = new_value(int_type(), KOOPA_RVT_BINARY);
+	val->kind.data.binary = {op, lhs, rhs};
+	return val;
+}
+
+bool is_comparison(koopa_raw_binary_op_t op) {
+	return op == KOOPA_RBO_LT || op == KOOPA_RBO_LE || op == KOOPA_RBO_GT || op == KOOPA_RBO_GE || op == KOOPA_RBO_NOT_EQ ||
+		   op == KOOPA_RBO_EQ;
+}
+
+// An innermost loop with one latch and one exit block, whose header stays in
+// the loop while `iv op bound`. iv is a header parameter that the back edge
+// steps by a constant, bound is defined outside the loop.
+class Counted_loop {
+public:
+	koopa_raw_basic_block_t header, preheader, latch, exit = nullptr;
+	koopa_raw_basic_block_t inside;                // where the header goes while the test holds
+	std::vector<koopa_raw_basic_block_t> blocks;   // reverse post order, the header first
+	std::unordered_set<koopa_raw_value_t> defined;
+	size_t iv;
+	koopa_raw_value_t init, bound;
+	koopa_raw_binary_op_t op;
+	int32_t step;
+	int size = 0;
+};
+
+bool match(const Loop &loop, const Cfg &cfg, Counted_loop &ret) {
+	if(loop.preheader == nullptr || loop.latches.size() != 1) return false;
+	ret.header = loop.header;
+	ret.preheader = loop.preheader;
+	ret.latch = loop.latches[0];
+	auto enter = get_terminator(ret.preheader), back = get_terminator(ret.latch);
+	if(enter->kind.tag != KOOPA_RVT_JUMP || back->kind.tag != KOOPA_RVT_JUMP) return false;
+	for(auto blk : cfg.rpo) {
+		if(!loop.contains(blk)) continue;
+		ret.blocks.push_back(blk);
+		ret.size += blk->insts.len;
+		for(auto param : to_vector<koopa_raw_value_t>(blk->params)) {
+			ret.defined.insert(param);
+		}
+		for(auto inst : get_insts(blk)) {
+			// every copy would get its own object
+			if(inst->kind.tag == KOOPA_RVT_ALLOC) return false;
+			ret.defined.insert(inst);
+		}
+		for(auto succ : cfg.succs.at(blk)) {
+			if(loop.contains(succ)) continue;
+			if(ret.exit != nullptr && ret.exit != succ) return false;
+			ret.exit = succ;
+		}
+	}
+	if(ret.exit == nullptr) return false;
+	for(auto pred : cfg.preds.at(ret.exit)) {
+		if(!loop.contains(pred)) return false;
+	}
+	auto test = get_terminator(ret.header);
+	if(test->kind.tag != KOOPA_RVT_BRANCH) return false;
+	auto &br = test->kind.data.branch;
+	bool stays = loop.contains(br.true_bb);
+	if(stays == loop.contains(br.false_bb)) return false;
+	ret.inside = stays ? br.true_bb : br.false_bb;
+	if(br.cond->kind.tag != KOOPA_RVT_BINARY) return false;
+	auto cmp = br.cond->kind.data.binary;
+	if(!is_comparison(cmp.op)) return false;
+	auto params = to_vector<koopa_raw_value_t>(ret.header->params);
+	auto index_of = [&](koopa_raw_value_t val) { return std::find(params.begin(), params.end(), val) - params.begin(); };
+	ret.op = cmp.op;
+	if(ret.defined.contains(cmp.lhs)) {
+		ret.iv = index_of(cmp.lhs);
+		ret.bound = cmp.rhs;
+	} else {
+		ret.iv = index_of(cmp.rhs);
+		ret.bound = cmp.lhs;
+		ret.op = swap_sides(ret.op);
+	}
+	if(ret.iv == params.size() || ret.defined.contains(ret.bound)) return false;
+	if(!stays) ret.op = negate(ret.op);
+	// a preheader made by insert_preheaders passes on what it is given
+	ret.init = constant_through(ret.preheader, (koopa_raw_value_t)enter->kind.data.jump.args.buffer[ret.iv], cfg);
+	auto next = (koopa_raw_value_t)back->kind.data.jump.args.buffer[ret.iv];
+	if(next->kind.tag != KOOPA_RVT_BINARY) return false;
+	auto inc = next->kind.data.binary;
+	if(inc.op == KOOPA_RBO_ADD && inc.rhs == params[ret.iv]) std::swap(inc.lhs, inc.rhs);
+	if(inc.op != KOOPA_RBO_ADD && inc.op != KOOPA_RBO_SUB) return false;
+	if(inc.lhs != params[ret.iv] || inc.rhs->kind.tag != KOOPA_RVT_INTEGER) return false;
+	int64_t step = inc.rhs->kind.data.integer.value;
+	if(inc.op == KOOPA_RBO_SUB) step = -step;
+	if(step == 0 || step > max_step || step < -max_step) return false;
+	ret.step = step;
+	return true;
+}
+
+// Trips of a loop that starts and ends at constants, -1 if too many to count.
+int trip_count(const Counted_loop &cl) {
+	if(cl.init->kind.tag != KOOPA_RVT_INTEGER || cl.bound->kind.tag != KOOPA_RVT_INTEGER) return -1;
+	uint32_t x = cl.init->kind.data.integer.value;
+	for(int trips = 0; trips <= max_full_trips; trips++) {
+		if(!holds(cl.op, x, cl.bound->kind.data.integer.value)) return trips;
+		x += (uint32_t)cl.step;
+	}
+	return -1;
+}
+
+// Values of the loop used after it reach there as new parameters of the exit
+// block, so that every copy of the loop can pass its own.
+void close_loop(koopa_raw_function_t func, const Counted_loop &cl) {
+	std::unordered_set<koopa_raw_basic_block_t> inside(cl.blocks.begin(), cl.blocks.end());
+	Value_map replace;
+	std::vector<const void *> live;
+	auto params = to_vector<const void *>(cl.exit->params);
+	for(auto blk : get_blocks(func)) {
+		if(inside.contains(blk)) continue;
+		for(auto inst : get_insts(blk)) {
+			for_each_operand(inst, [&](koopa_raw_value_t &opr) {
+				if(!cl.defined.contains(opr)) return;
+				auto &param = replace[opr];
+				if(param == nullptr) {
+					auto now = new_value(opr->ty, KOOPA_RVT_BLOCK_ARG_REF);
+					now->kind.data.block_arg_ref.index = params.size();
+					params.push_back(now);
+					live.push_back(opr);
+					param = now;
+				}
+				opr = param;
+			});
+		}
+	}
+	if(live.empty()) return;
+	mut(cl.exit)->params = make_slice(params, KOOPA_RSIK_VALUE);
+	for(auto blk : cl.blocks) {
+		auto term = get_terminator(blk);
+		for(int i = 0; i < edge_count(term); i++) {
+			if(edge_target(term, i) != cl.exit) continue;
+			auto args = to_vector<const void *>(edge_args(term, i));
+			args.insert(args.end(), live.begin(), live.end());
+			edge_args(term, i) = make_slice(args, KOOPA_RSIK_VALUE);
+		}
+	}
+}
+
+class Trip {
+public:
+	koopa_raw_basic_block_t entry;         // the copy of the header
+	koopa_raw_value_t back;                // the copy of the latch jump, still going to the header
+	std::vector<koopa_raw_value_t> next;   // what it passes to the header
+};
+
+// Copies one trip around the loop with the header parameters bound to vals,
+// folding what becomes constant. With in_loop the header test is taken to hold.
+Trip clone_trip(const Counted_loop &cl, const std::vector<koopa_raw_value_t> &vals, bool in_loop,
+				std::vector<koopa_raw_basic_block_t> &added) {
+	Value_map map;
+	std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> blks;
+	auto params = to_vector<koopa_raw_value_t>(cl.header->params);
+	for(size_t i = 0; i < params.size(); i++) {
+		map[params[i]] = vals[i];
+	}
+	for(auto old : cl.blocks) {
+		auto now = new_block(old->name);
+		if(old != cl.header) {
+			std::vector<const void *> copies;
+			for(auto param : to_vector<koopa_raw_value_t>(old->params)) {
+				auto copy = new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF);
+				copy->kind = param->kind;
+				map[param] = copy;
+				copies.push_back(copy);
+			}
+			now->params = make_slice(copies, KOOPA_RSIK_VALUE);
+		}
+		blks[old] = now;
+		added.push_back(now);
+	}
+	auto test = get_terminator(cl.header);
+	auto copy_slice = [](koopa_raw_slice_t &slice) { slice = make_slice(to_vector<const void *>(slice), slice.kind); };
+	Trip ret{blks[cl.header], nullptr, {}};
+	// in reverse post order an operand is copied before its uses
+	for(auto old : cl.blocks) {
+		std::vector<koopa_raw_value_t> copies;
+		for(auto inst : get_insts(old)) {
+			auto copy = new_value(inst->ty, inst->kind.tag);
+			copy->kind = inst->kind;
+			auto &kind = copy->kind;
+			if(kind.tag == KOOPA_RVT_CALL) copy_slice(kind.data.call.args);
+			for(int i = 0; i < edge_count(copy); i++) {
+				copy_slice(edge_args(copy, i));
+			}
+			for_each_operand(copy, [&](koopa_raw_value_t &opr) {
+				if(auto it = map.find(opr); it != map.end()) opr = it->second;
+			});
+			int32_t folded;
+			if(kind.tag == KOOPA_RVT_BINARY && fold(kind.data.binary, folded)) {
+				map[inst] = new_integer(folded);
+				continue;
+			}
+			if(kind.tag == KOOPA_RVT_BRANCH) {
+				int taken = -1;
+				if(inst == test && in_loop) {
+					taken = kind.data.branch.true_bb == cl.inside ? 0 : 1;
+				} else if(kind.data.branch.cond->kind.tag == KOOPA_RVT_INTEGER) {
+					taken = kind.data.branch.cond->kind.data.integer.value != 0 ? 0 : 1;
+				}
+				if(taken >= 0) {
+					auto target = edge_target(copy, taken);
+					auto args = edge_args(copy, taken);
+					kind.tag = KOOPA_RVT_JUMP;
+					kind.data.jump.target = target;
+					kind.data.jump.args = args;
+				}
+			}
+			for(int i = 0; i < edge_count(copy); i++) {
+				auto &target = edge_target(copy, i);
+				if(target == cl.header) {
+					ret.back = copy;
+					ret.next = to_vector<koopa_raw_value_t>(edge_args(copy, i));
+				} else if(auto it = blks.find(target); it != blks.end()) {
+					target = it->second;
+				}
+			}
+			map[inst] = copy;
+			copies.push_back(copy);
+		}
+		set_insts(blks.at(old), copies);
+	}
+	return ret;
+}
+
+// One copy per trip and one more whose header test fails, all folded.
+void unroll_fully(const Counted_loop &cl, int trips, std::vector<koopa_raw_basic_block_t> &added) {
+	koopa_raw_value_t last = get_terminator(cl.preheader);
+	auto vals = to_vector<koopa_raw_value_t>(last->kind.data.jump.args);
+	vals[cl.iv] = cl.init;
+	for(int i = 0; i <= trips; i++) {
+		auto trip = clone_trip(cl, vals, false, added);
+		point(last, trip.entry, {});
+		// a loop of one block has no back edge once its test folds
+		if(trip.back == nullptr) return;
+		last = trip.back;
+		vals = trip.next;
+	}
+	// not reached, the last test folds to the exit
+	point(last, cl.header, vals);
+}
+
+// A new loop runs factor trips at a time while that many are certain to be
+// left, then the original loop runs the rest. Returns the new header.
+koopa_raw_basic_block_t unroll_by(const Counted_loop &cl, int factor, std::vector<koopa_raw_basic_block_t> &added) {
+	auto head = new_block("%unrolled");
+	std::vector<const void *> params;
+	std::vector<koopa_raw_value_t> vals;
+	for(auto param : to_vector<koopa_raw_value_t>(cl.header->params)) {
+		auto now = new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF);
+		now->kind.data.block_arg_ref.index = params.size();
+		params.push_back(now);
+		vals.push_back(now);
+	}
+	head->params = make_slice(params, KOOPA_RSIK_VALUE);
+	// the distance to the bound is compared as an unsigned number, it can not
+	// overflow once iv is in range while iv + (factor - 1) * step can
+	auto iv = vals[cl.iv];
+	bool up = cl.step > 0;
+	int need = (factor - 1) * (up ? cl.step : -cl.step) - (cl.op == KOOPA_RBO_LE || cl.op == KOOPA_RBO_GE);
+	auto in_range = new_binary(cl.op, iv, cl.bound);
+	auto left = up ? new_binary(KOOPA_RBO_SUB, cl.bound, iv) : new_binary(KOOPA_RBO_SUB, iv, cl.bound);
+	auto above = new_binary(KOOPA_RBO_GT, left, new_integer(need));
+	auto wrapped = new_binary(KOOPA_RBO_LT, left, new_integer(0));
+	auto enough = new_binary(KOOPA_RBO_OR, above, wrapped);
+	auto ok = new_binary(KOOPA_RBO_AND, in_range, enough);
+	auto br = new_value(unit_type(), KOOPA_RVT_BRANCH);
+	br->kind.data.branch.cond = ok;
+	br->kind.data.branch.false_bb = cl.header;
+	br->kind.data.branch.false_args = make_slice(params, KOOPA_RSIK_VALUE);
+	br->kind.data.branch.true_args = make_slice({}, KOOPA_RSIK_VALUE);
+	set_insts(head, {in_range, left, above, wrapped, enough, ok, br});
+	added.push_back(head);
+	retarget(get_terminator(cl.preheader), cl.header, head);
+	koopa_raw_value_t last = nullptr;
+	for(int i = 0; i < factor; i++) {
+		auto trip = clone_trip(cl, vals, true, added);
+		if(last == nullptr) {
+			br->kind.data.branch.true_bb = trip.entry;
+		} else {
+			point(last, trip.entry, {});
+		}
+		last = trip.back;
+		vals = trip.next;
+	}
+	point(last, head, vals);
+	return head;
+}
+
+}   // namespace Unroll_Defs
+
+using namespace Unroll_Defs;
+
+int unroll_loops(koopa_raw_function_t func) {
+	int factor = Options::unroll_factor;
+	if(factor <= 0) return 0;
+	int full = 0, partial = 0;
+	// loops already looked at, by header, so that the new loops are left alone
+	std::unordered_set<koopa_raw_basic_block_t> tried;
+	for(bool changed = true; changed;) {
+		changed = false;
+		insert_preheaders(func);
+		Cfg cfg(func);
+		Dom_tree dom(cfg);
+		Loop_info info(cfg, dom);
+		for(auto &loop : info.loops) {
+			// an outer loop is tried once the loops inside it are unrolled fully
+			bool innermost = true;
+			for(auto blk : loop->blocks) {
+				innermost &= info.innermost.at(blk) == loop.get();
+			}
+			if(!innermost || !tried.insert(loop->header).second) continue;
+			Counted_loop cl;
+			if(!match(*loop, cfg, cl)) continue;
+			int trips = trip_count(cl);
+			bool fully = trips >= 0 && (trips + 1) * cl.size <= max_size;
+			bool up = cl.op == KOOPA_RBO_LT || cl.op == KOOPA_RBO_LE, down = cl.op == KOOPA_RBO_GT || cl.op == KOOPA_RBO_GE;
+			// a constant trip count below the factor would only ever run the rest
+			bool by_factor = factor > 1 && factor <= max_size / cl.size && (cl.step > 0 ? up : down) && (trips < 0 || trips >= factor);
+			if(!fully && !by_factor) continue;
+			close_loop(func, cl);
+			std::vector<koopa_raw_basic_block_t> added;
+			if(fully) {
+				unroll_fully(cl, trips, added);
+				full++;
+			} else {
+				tried.insert(unroll_by(cl, factor, added));
+				partial++;
+			}
+			auto blks = get_blocks(func);
+			blks.insert(blks.end(), added.begin(), added.end());
+			set_blocks(func, blks);
+			order_blocks(func);
+			changed = true;
+			break;
+		}
+	}
+	report("unroll", func,
+		   std::to_string(full) + " loops unrolled fully, " + std::to_string(partial) + " by " + std::to_string(factor));
+	return full + partial;
+}
+
+}   // namespace Koopa_Opt
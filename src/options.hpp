@@ -0,0 +1,13 @@
+#pragma once
+
+// Command line switches shared by the frontend and the backend.
+namespace Options {
+
+extern bool memoize_pure;   // cache results of pure recursive int functions
+extern bool opt_report;     // describe what the optimizations did on stderr
+extern bool optimize;       // run the passes on the raw program, -O0 turns them off
+extern int inline_threshold;   // callee size allowed at a call outside loops, 0 turns inlining off
+extern bool inline_report;     // print every inlining decision on stderr
+extern int unroll_factor;      // body copies per trip of a counted loop, 1 only unrolls fully and 0 not at all
+
+}   // namespace Options
@@ -29,10 +29,11 @@ std::unique_ptr<T> cast_ast(BaseAST *p){
 %parse-param { std::unique_ptr<BaseAST> &ast }
 
 %union {
-	std::string *str_val;
+	Ast_Base::Ident ident_val;
 	int int_val;
 	BaseAST *ast_val;
-	std::list<BaseAST*> *list_val;
+	Op_type op_val;
+	Ast_Base::Ast_list<BaseAST*> *list_val;
 }
 
 %token IF ELSE
@@ -47,7 +48,7 @@ std::unique_ptr<T> cast_ast(BaseAST *p){
 %token LNOT LAND LOR
 %token WHILE
 %token BREAK CONTINUE
-%token <str_val> IDENT
+%token <ident_val> IDENT
 %token <int_val> INT_CONST
 
 %type <ast_val> CompUnit FuncDef FuncDefParams FuncDefParam FuncCallParams
@@ -58,11 +59,11 @@ std::unique_ptr<T> cast_ast(BaseAST *p){
 %type <list_val> ArrayDimension ConstInitValList InitValList
 
 // BINARY operators.
-%type <ast_val> AddOp SubOp MulOp DivOp ModOp
-%type <ast_val> LeOp LtOp GeOp GtOp EqOp NeqOp
-%type <ast_val> LAndOp LOrOp
+%type <op_val> AddOp SubOp MulOp DivOp ModOp
+%type <op_val> LeOp LtOp GeOp GtOp EqOp NeqOp
+%type <op_val> LAndOp LOrOp
 
-%type <ast_val> UnaryOp Lv0Op Lv1Op Lv2Op Lv3Op Lv4Op Lv5Op
+%type <op_val> UnaryOp Lv0Op Lv1Op Lv2Op Lv3Op Lv4Op Lv5Op
 %type <int_val> Number
 
 %%
@@ -73,22 +74,27 @@ Compile_loader:
 	}
 	;
 
+// The unit is made before any item, the hook sees it empty first.
 CompUnit:
-	Decl {
-		auto ast = new CompUnitAST();
-		ast->decls.push_back(cast_ast<DeclAST>($1));
-		$$ = ast;
-	} | FuncDef {
+	{
 		auto ast = new CompUnitAST();
-		ast->decls.push_back(cast_ast<FuncDefAST>($1));
+		if(top_level_hook) {
+			top_level_hook(*ast);
+		}
 		$$ = ast;
 	} | CompUnit Decl {
 		auto ast = (CompUnitAST*)$1;
 		ast->decls.push_back(cast_ast<DeclAST>($2));
+		if(top_level_hook) {
+			top_level_hook(*ast);
+		}
 		$$ = ast;
 	} | CompUnit FuncDef {
 		auto ast = (CompUnitAST*)$1;
 		ast->decls.push_back(cast_ast<FuncDefAST>($2));
+		if(top_level_hook) {
+			top_level_hook(*ast);
+		}
 		$$ = ast;
 	}
 	;
@@ -97,14 +103,14 @@ FuncDef:
 	Type IDENT '(' FuncDefParams ')' Block {
 		auto ast = new FuncDefAST();
 		ast->func_typ = cast_ast<TypeAST>($1);
-		ast->ident = *std::unique_ptr<std::string>($2);
+		ast->ident = $2;
 		ast->params = cast_ast<FuncDefParamsAST>($4);
 		ast->block = cast_ast<BlockAST>($6);
 		$$ = ast;
 	} | Type IDENT '(' ')' Block {
 		auto ast = new FuncDefAST();
 		ast->func_typ = cast_ast<TypeAST>($1);
-		ast->ident = *std::unique_ptr<std::string>($2);
+		ast->ident = $2;
 		ast->block = cast_ast<BlockAST>($5);
 		$$ = ast;
 	}
@@ -139,15 +145,15 @@ FuncDefParam:
 	Type IDENT {
 		auto ast = new FuncDefParamAST();
 		ast->typ = cast_ast<TypeAST>($1);
-		ast->id = *$2;
+		ast->id = $2;
 		ast->is_ptr = false;
 		$$ = ast;
 	} | Type IDENT '[' ']' ArrayDimension {
 		auto ast = new FuncDefParamAST();
 		ast->typ = cast_ast<TypeAST>($1);
-		ast->id = *$2;
+		ast->id = $2;
 		ast->is_ptr = true;
-		ast->dim_list = std::make_unique<std::list<std::unique_ptr<ExpAST>>>();
+		ast->dim_list = std::make_unique<Ast_Base::Ast_list<std::unique_ptr<ExpAST>>>();
 		for(auto &i: *$5){
 			ast->dim_list->push_back(cast_ast<ExpAST>(i));
 		}
@@ -229,8 +235,8 @@ ConstDefList:
 ConstDef:
 	IDENT ArrayDimension '=' ConstInitVal {
 		auto ast = new ConstDefAST();
-		ast->ident = *$1;
-		ast->dim_list = std::make_unique<std::list<std::unique_ptr<ExpAST>>>();
+		ast->ident = $1;
+		ast->dim_list = std::make_unique<Ast_Base::Ast_list<std::unique_ptr<ExpAST>>>();
 		for(auto i: *$2){
 			ast->dim_list->push_back(cast_ast<ExpAST>(i));
 		}
@@ -249,12 +255,12 @@ ConstInitVal:
 	} | '{' '}' {
 		auto ast = new ConstInitValAST();
 		ast->is_zero = true;
-		ast->exp = std::list<std::unique_ptr<ConstInitValAST>>();
+		ast->exp = Ast_Base::Ast_list<std::unique_ptr<ConstInitValAST>>();
 		$$ = ast;
 	} | '{' ConstInitValList '}' {
 		auto ast = new ConstInitValAST();
 		ast->is_zero = false;
-		std::list<std::unique_ptr<ConstInitValAST>> init_val;
+		Ast_Base::Ast_list<std::unique_ptr<ConstInitValAST>> init_val;
 		for(auto &i: *$2){
 			init_val.push_back(cast_ast<ConstInitValAST>(i));
 		}
@@ -266,7 +272,7 @@ ConstInitVal:
 
 ConstInitValList:
 	ConstInitVal {
-		auto list = new std::list<BaseAST*>;
+		auto list = new Ast_Base::Ast_list<BaseAST*>;
 		list->push_back($1);
 		$$ = list;
 	} | ConstInitValList ',' ConstInitVal {
@@ -279,7 +285,7 @@ ConstExp:
 	Exp {
 		auto ast = new ConstExpAST();
 		auto exp = (ExpAST*)$1;
-		ast->binary_exp = std::move(exp->binary_exp);
+		ast->nodes = std::move(exp->nodes);
 		delete $1;
 		$$ = ast;
 	};
@@ -305,8 +311,8 @@ VarDefList:
 VarDef:
 	IDENT ArrayDimension {
 		auto ast = new VarDefAST();
-		ast->ident = *$1;
-		ast->dim_list = std::make_unique<std::list<std::unique_ptr<ExpAST>>>();
+		ast->ident = $1;
+		ast->dim_list = std::make_unique<Ast_Base::Ast_list<std::unique_ptr<ExpAST>>>();
 		for(auto i: *$2){
 			ast->dim_list->push_back(cast_ast<ExpAST>(i));
 		}
@@ -314,8 +320,8 @@ VarDef:
 		$$ = ast;
 	} | IDENT ArrayDimension '=' InitVal {
 		auto ast = new VarDefAST();
-		ast->ident = *$1;
-		ast->dim_list = std::make_unique<std::list<std::unique_ptr<ExpAST>>>();
+		ast->ident = $1;
+		ast->dim_list = std::make_unique<Ast_Base::Ast_list<std::unique_ptr<ExpAST>>>();
 		for(auto i: *$2){
 			ast->dim_list->push_back(cast_ast<ExpAST>(i));
 		}
@@ -332,12 +338,12 @@ InitVal:
 	} | '{' '}' {
 		auto ast = new InitValAST();
 		ast->is_zero = true;
-		ast->exp = std::list<std::unique_ptr<InitValAST>>();
+		ast->exp = Ast_Base::Ast_list<std::unique_ptr<InitValAST>>();
 		$$ = ast;
 	} | '{' InitValList '}' {
 		auto ast = new InitValAST();
 		ast->is_zero = false;
-		std::list<std::unique_ptr<InitValAST>> init_val;
+		Ast_Base::Ast_list<std::unique_ptr<InitValAST>> init_val;
 		for(auto &i: *$2){
 			init_val.push_back(cast_ast<InitValAST>(i));
 		}
@@ -349,7 +355,7 @@ InitVal:
 
 InitValList:
 	InitVal {
-		auto list = new std::list<BaseAST*>;
+		auto list = new Ast_Base::Ast_list<BaseAST*>;
 		list->push_back($1);
 		$$ = list;
 	} | InitValList ',' InitVal {
@@ -385,7 +391,9 @@ Stmt:
 		$$ = ast;
 	} | Exp ';' {
 		auto ast = new StmtAST();
-		ast->val = cast_ast<OptionalExpAST>($1);
+		auto exp_ast = std::make_unique<OptionalExpAST>();
+		exp_ast->exp = cast_ast<ExpAST>($1);
+		ast->val = std::move(exp_ast);
 		$$ = ast;
 	} | Block {
 		auto ast = new StmtAST();
@@ -433,8 +441,8 @@ If:
 LVal:
 	IDENT ArrayDimension {
 		auto ast = new LValAST();
-		ast->ident = *$1;
-		ast->dim_list = std::make_unique<std::list<std::unique_ptr<ExpAST>>>();
+		ast->ident = $1;
+		ast->dim_list = std::make_unique<Ast_Base::Ast_list<std::unique_ptr<ExpAST>>>();
 		for(auto i: *$2){
 			ast->dim_list->push_back(cast_ast<ExpAST>(i));
 		}
@@ -442,73 +450,55 @@ LVal:
 		$$ = ast;
 	};
 
-Exp:
-	LOrExp {
-		auto ast = new ExpAST();
-		ast->binary_exp = cast_ast<LOrExpAST>($1);
-		$$ = ast;
-	}
-	;
+Exp: LOrExp ;
 
 PrimaryExp:
-	'(' Exp ')' { 
-		auto ast = new PrimaryExpAST();
-		ast->inside_exp = cast_ast<ExpAST>($2);
-		$$ = ast;
+	'(' Exp ')' {
+		$$ = $2;
 	}
 	| LVal {
-		auto ast = new PrimaryExpAST();
-		ast->inside_exp = cast_ast<LValAST>($1);
-		$$ = ast;
+		$$ = ExpAST::lval((LValAST*)$1);
 	}
 	| Number {
-		auto ast = new PrimaryExpAST();
-		ast->inside_exp = $1;
-		$$ = ast;
+		$$ = ExpAST::number($1);
 	};
 
 UnaryExp:
-	PrimaryExp {
-		auto ast = new UnaryExpAST();
-		ast->unary_exp = cast_ast<PrimaryExpAST>($1);
-		$$ = ast;
-	} | IDENT '(' ')' {
+	PrimaryExp
+	| IDENT '(' ')' {
 		auto ast = new FuncCallAST();
-		ast->func = *$1;
+		ast->func = $1;
 		ast->params = std::make_unique<FuncCallParamsAST>();
-		$$ = ast;
+		$$ = ExpAST::call(ast);
 	} | IDENT '(' FuncCallParams ')' {
 		auto ast = new FuncCallAST();
-		ast->func = *$1;
+		ast->func = $1;
 		ast->params = cast_ast<FuncCallParamsAST>($3);
-		$$ = ast;
+		$$ = ExpAST::call(ast);
 	} | UnaryOp UnaryExp{
-		auto ast = new UnaryExpAST();
-		ast->unary_op = cast_ast<UnaryOpAST>($1);
-		ast->unary_exp = cast_ast<UnaryExpAST>($2);
-		$$ = ast;
+		$$ = ExpAST::unary($1, (ExpAST*)$2);
 	}
 	;
 
-AddOp: ADD		{ $$ = new BinaryOpAST(OP_ADD); } ;
-SubOp: SUB		{ $$ = new BinaryOpAST(OP_SUB); } ;
-MulOp: MUL		{ $$ = new BinaryOpAST(OP_MUL); } ;
-DivOp: DIV		{ $$ = new BinaryOpAST(OP_DIV); } ;
-ModOp: MOD		{ $$ = new BinaryOpAST(OP_MOD); } ;
-GtOp: GT 		{ $$ = new BinaryOpAST(OP_GT); } ;
-GeOp: GE 		{ $$ = new BinaryOpAST(OP_GE); } ;
-LtOp: LT 		{ $$ = new BinaryOpAST(OP_LT); } ;
-LeOp: LE 		{ $$ = new BinaryOpAST(OP_LE); } ;
-EqOp: EQ 		{ $$ = new BinaryOpAST(OP_EQ); } ;
-NeqOp: NEQ 		{ $$ = new BinaryOpAST(OP_NEQ); } ;
-LAndOp: LAND 	{ $$ = new BinaryOpAST(OP_LAND); } ;
-LOrOp: LOR 		{ $$ = new BinaryOpAST(OP_LOR); } ;
+AddOp: ADD		{ $$ = OP_ADD; } ;
+SubOp: SUB		{ $$ = OP_SUB; } ;
+MulOp: MUL		{ $$ = OP_MUL; } ;
+DivOp: DIV		{ $$ = OP_DIV; } ;
+ModOp: MOD		{ $$ = OP_MOD; } ;
+GtOp: GT 		{ $$ = OP_GT; } ;
+GeOp: GE 		{ $$ = OP_GE; } ;
+LtOp: LT 		{ $$ = OP_LT; } ;
+LeOp: LE 		{ $$ = OP_LE; } ;
+EqOp: EQ 		{ $$ = OP_EQ; } ;
+NeqOp: NEQ 		{ $$ = OP_NEQ; } ;
+LAndOp: LAND 	{ $$ = OP_LAND; } ;
+LOrOp: LOR 		{ $$ = OP_LOR; } ;
 
 
 UnaryOp: 
-	ADD 	{ $$ = new UnaryOpAST(OP_ADD); }
-	| SUB 	{ $$ = new UnaryOpAST(OP_SUB); }
-	| LNOT 	{ $$ = new UnaryOpAST(OP_LNOT); }
+	ADD 	{ $$ = OP_ADD; }
+	| SUB 	{ $$ = OP_SUB; }
+	| LNOT 	{ $$ = OP_LNOT; }
 	;
 
 Lv0Op: MulOp | DivOp | ModOp ;
@@ -518,91 +508,44 @@ Lv3Op: EqOp | NeqOp ;
 Lv4Op: LAndOp ;
 Lv5Op: LOrOp ;
 
+// Each level only combines the flat expressions below it.
 MulExp:
-	UnaryExp {
-		auto ast = new MulExpAST();
-		ast->nxt_level = cast_ast<UnaryExpAST>($1);
-		$$ = ast;
-	}
+	UnaryExp
 	| MulExp Lv0Op UnaryExp {
-		auto ast = new MulExpAST();
-		ast->now_level = cast_ast<MulExpAST>($1);
-		ast->binary_op = cast_ast<BinaryOpAST>($2);
-		ast->nxt_level = cast_ast<UnaryExpAST>($3);
-		$$ = ast;
+		$$ = ExpAST::binary($2, (ExpAST*)$1, (ExpAST*)$3);
 	}
 	;
 
 AddExp:
-	MulExp {
-		auto ast = new AddExpAST();
-		ast->nxt_level = cast_ast<MulExpAST>($1);
-		$$ = ast;
-	}
+	MulExp
 	| AddExp Lv1Op MulExp {
-		auto ast = new AddExpAST();
-		ast->now_level = cast_ast<AddExpAST>($1);
-		ast->binary_op = cast_ast<BinaryOpAST>($2);
-		ast->nxt_level = cast_ast<MulExpAST>($3);
-		$$ = ast;
-	} 
+		$$ = ExpAST::binary($2, (ExpAST*)$1, (ExpAST*)$3);
+	}
 	;
 
 RelExp:
-	AddExp {
-		auto ast = new RelExpAST();
-		ast->nxt_level = cast_ast<AddExpAST>($1);
-		$$ = ast;
-	}
+	AddExp
 	| RelExp Lv2Op AddExp {
-		auto ast = new RelExpAST();
-		ast->now_level = cast_ast<RelExpAST>($1);
-		ast->binary_op = cast_ast<BinaryOpAST>($2);
-		ast->nxt_level = cast_ast<AddExpAST>($3);
-		$$ = ast;
+		$$ = ExpAST::binary($2, (ExpAST*)$1, (ExpAST*)$3);
 	}
 	;
 
 EqExp:
-	RelExp {
-		auto ast = new EqExpAST();
-		ast->nxt_level = cast_ast<RelExpAST>($1);
-		$$ = ast;
-	}
+	RelExp
 	| EqExp Lv3Op RelExp {
-		auto ast = new EqExpAST();
-		ast->now_level = cast_ast<EqExpAST>($1);
-		ast->binary_op = cast_ast<BinaryOpAST>($2);
-		ast->nxt_level = cast_ast<RelExpAST>($3);
-		$$ = ast;
+		$$ = ExpAST::binary($2, (ExpAST*)$1, (ExpAST*)$3);
 	};
 
 LAndExp:
-	EqExp {
-		auto ast = new LAndExpAST();
-		ast->nxt_level = cast_ast<EqExpAST>($1);
-		$$ = ast;
-	}
+	EqExp
 	| LAndExp Lv4Op EqExp {
-		auto ast = new LAndExpAST();
-		ast->now_level = cast_ast<LAndExpAST>($1);
-		ast->binary_op = cast_ast<BinaryOpAST>($2);
-		ast->nxt_level = cast_ast<EqExpAST>($3);
-		$$ = ast;
+		$$ = ExpAST::binary($2, (ExpAST*)$1, (ExpAST*)$3);
 	};
 
 LOrExp:
-	LAndExp {
-		auto ast = new LOrExpAST();
-		ast->nxt_level = cast_ast<LAndExpAST>($1);
-		$$ = ast;
-	}
+	LAndExp
 	| LOrExp Lv5Op LAndExp {
-		auto ast = new LOrExpAST();
-		ast->now_level = cast_ast<LOrExpAST>($1);
-		ast->binary_op = cast_ast<BinaryOpAST>($2);
-		ast->nxt_level = cast_ast<LAndExpAST>($3);
-		$$ = ast;
+		$$ = ExpAST::binary($2, (ExpAST*)$1, (ExpAST*)$3);
 	};
 
 
@@ -610,7 +553,7 @@ Number: INT_CONST;
 
 ArrayDimension:
 	{
-		$$ = new std::list<BaseAST*>();
+		$$ = new Ast_Base::Ast_list<BaseAST*>();
 	} | ArrayDimension '[' Exp ']' {
 		$1->push_back($3);
 		$$ = $1;